@@ -363,6 +363,7 @@ mips_trap(struct trapframe *tf)
  * outside the mips port, but should be called from one of the
  * following places:
  *    - enter_new_process, for use by exec and equivalent.
+ *    - enter_new_thread, for use by threadfork.
  *    - enter_forked_process, in syscall.c, for use by fork.
  */
 void
@@ -431,3 +432,23 @@ enter_new_process(int argc, userptr_t argv, vaddr_t stack, vaddr_t entry)
 
 	mips_usermode(&tf);
 }
+
+/*
+ * enter_new_thread: go to user mode in a new thread of an existing
+ * process. Like enter_new_process, but the single argument ARG is
+ * passed to the function at ENTRY.
+ */
+void
+enter_new_thread(userptr_t arg, vaddr_t stack, vaddr_t entry)
+{
+	struct trapframe tf;
+
+	bzero(&tf, sizeof(tf));
+
+	tf.tf_status = CST_IRQMASK | CST_IEp | CST_KUp;
+	tf.tf_epc = entry;
+	tf.tf_a0 = (vaddr_t)arg;
+	tf.tf_sp = stack;
+
+	mips_usermode(&tf);
+}
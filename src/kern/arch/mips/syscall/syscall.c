@@ -30,6 +30,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/syscall.h>
+#include <kern/batch.h>
 #include <lib.h>
 #include <mips/trapframe.h>
 #include <copyinout.h>
@@ -77,8 +78,17 @@
  * registerized values, with copyin().
  */
 
-void
-syscall(struct trapframe *tf)
+static int sys_batch(struct trapframe *tf, userptr_t recs, int nrecs,
+                     int flags, int32_t *retval);
+
+/*
+ * Run the call numbered in TF's v0 with the arguments in TF, and hand
+ * back its error code and its return value in RETVALP (and RETVALV1P for
+ * the low word of a 64-bit value).
+ */
+static
+int
+syscall_dispatch(struct trapframe *tf, int32_t *retvalp, int32_t *retvalv1p)
 {
   int callno;
   int32_t retval;
@@ -86,10 +96,7 @@ syscall(struct trapframe *tf)
   int64_t retval64;
   int err;
   int32_t stackarg1;
-
-  KASSERT(curthread != NULL);
-  KASSERT(curthread->t_curspl == 0);
-  KASSERT(curthread->t_iplhigh_count == 0);
+  off_t stackarg64;
 
   callno = tf->tf_v0;
 
@@ -112,6 +119,9 @@ syscall(struct trapframe *tf)
       err = sys___time((userptr_t)tf->tf_a0,
           (userptr_t)tf->tf_a1);
       break;
+    case SYS_nanosleep:
+      err = sys_nanosleep((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+      break;
     case SYS__exit:
       sys__exit(tf->tf_a0);
       panic("Returning from exit\n");
@@ -121,6 +131,9 @@ syscall(struct trapframe *tf)
     case SYS_fork:
       err = sys_fork(tf, &retval);
       break;
+    case SYS_spawn:
+      err = sys_spawn((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1, &retval);
+      break;
     case SYS_waitpid:
       err = sys_waitpid(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, 
           &retval);
@@ -128,6 +141,10 @@ syscall(struct trapframe *tf)
     case SYS_getpid:
       err = sys_getpid(&retval);
       break;
+    case SYS___threadfork:
+      err = sys___threadfork((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+          (userptr_t)tf->tf_a2, &retval);
+      break;
     case SYS_open:
       err = sys_open((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2, 
           &retval);
@@ -140,6 +157,49 @@ syscall(struct trapframe *tf)
       err = sys_write(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, 
           &retval);
       break;
+    case SYS_pread:
+      /* the 64-bit offset doesn't fit in a3, so it's on the stack */
+      err = copyin((const_userptr_t) tf->tf_sp + 16, &stackarg64,
+          sizeof(off_t));
+      if (err) {
+        break;
+      }
+      err = sys_pread(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+          stackarg64, &retval);
+      break;
+    case SYS_pwrite:
+      err = copyin((const_userptr_t) tf->tf_sp + 16, &stackarg64,
+          sizeof(off_t));
+      if (err) {
+        break;
+      }
+      err = sys_pwrite(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+          stackarg64, &retval);
+      break;
+    case SYS_readv:
+      err = sys_readv(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &retval);
+      break;
+    case SYS_writev:
+      err = sys_writev(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &retval);
+      break;
+    case SYS_preadv:
+      err = copyin((const_userptr_t) tf->tf_sp + 16, &stackarg64,
+          sizeof(off_t));
+      if (err) {
+        break;
+      }
+      err = sys_preadv(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+          stackarg64, &retval);
+      break;
+    case SYS_pwritev:
+      err = copyin((const_userptr_t) tf->tf_sp + 16, &stackarg64,
+          sizeof(off_t));
+      if (err) {
+        break;
+      }
+      err = sys_pwritev(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+          stackarg64, &retval);
+      break;
     case SYS_close:
       err = sys_close(tf->tf_a0);
       break;
@@ -150,6 +210,62 @@ syscall(struct trapframe *tf)
       retval = retval64 >> 32;
       retvalv1 = (int) retval64;
       break;
+    case SYS_pipe:
+      err = sys_pipe((userptr_t)tf->tf_a0, &retval);
+      break;
+    case SYS_copy_file_range:
+      /* the length is the fifth argument, so it's on the stack */
+      err = copyin((const_userptr_t) tf->tf_sp + 16, &stackarg1,
+          sizeof(int32_t));
+      if (err) {
+        break;
+      }
+      err = sys_copy_file_range(tf->tf_a0, (userptr_t)tf->tf_a1,
+          tf->tf_a2, (userptr_t)tf->tf_a3, stackarg1, &retval);
+      break;
+    case SYS_aio_read:
+      err = copyin((const_userptr_t) tf->tf_sp + 16, &stackarg64,
+          sizeof(off_t));
+      if (err) {
+        break;
+      }
+      err = sys_aio_read(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+          stackarg64, &retval);
+      break;
+    case SYS_aio_write:
+      err = copyin((const_userptr_t) tf->tf_sp + 16, &stackarg64,
+          sizeof(off_t));
+      if (err) {
+        break;
+      }
+      err = sys_aio_write(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+          stackarg64, &retval);
+      break;
+    case SYS_aio_wait:
+      err = sys_aio_wait(tf->tf_a0, &retval);
+      break;
+    case SYS_poll:
+      err = sys_poll((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
+      break;
+    case SYS_fstat:
+      err = sys_fstat(tf->tf_a0, (userptr_t)tf->tf_a1);
+      break;
+    case SYS_stat:
+    case SYS_lstat:
+      err = sys_stat((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+      break;
+    case SYS_fsync:
+      err = sys_fsync(tf->tf_a0);
+      break;
+    case SYS_ftruncate:
+      /* the 64-bit length is aligned into a2/a3 */
+      err = sys_ftruncate(tf->tf_a0,
+          (off_t) ((off_t) tf->tf_a2 << 32 | (off_t) tf->tf_a3));
+      break;
+    case SYS_getdirentry:
+      err = sys_getdirentry(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+          &retval);
+      break;
     case SYS_dup2:
       err = sys_dup2(tf->tf_a0, tf->tf_a1, &retval);
       break;
@@ -162,12 +278,39 @@ syscall(struct trapframe *tf)
 	 case SYS_sbrk:
 		err = (int)sys_sbrk((intptr_t)tf->tf_a0,(vaddr_t *) &retval);
 		break;
+    case SYS_futex_wait:
+      err = sys_futex_wait((userptr_t)tf->tf_a0, tf->tf_a1);
+      break;
+    case SYS_futex_wake:
+      err = sys_futex_wake((userptr_t)tf->tf_a0, tf->tf_a1, &retval);
+      break;
+    case SYS_batch:
+      err = sys_batch(tf, (userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+          &retval);
+      break;
     default:
       kprintf("Unknown syscall %d\n", callno);
       err = ENOSYS;
       break;
   }
 
+  *retvalp = retval;
+  *retvalv1p = retvalv1;
+  return err;
+}
+
+void
+syscall(struct trapframe *tf)
+{
+  int32_t retval;
+  int32_t retvalv1;
+  int err;
+
+  KASSERT(curthread != NULL);
+  KASSERT(curthread->t_curspl == 0);
+  KASSERT(curthread->t_iplhigh_count == 0);
+
+  err = syscall_dispatch(tf, &retval, &retvalv1);
 
   if (err) {
     /*
@@ -198,6 +341,89 @@ syscall(struct trapframe *tf)
   KASSERT(curthread->t_iplhigh_count == 0);
 }
 
+/*
+ * Batched system calls: run each record of the user array RECS in
+ * turn, in this one trip into the kernel, storing each one's results
+ * back into its record (see <kern/batch.h>). Returns the number of
+ * records run. With BATCH_STOPONERR that stops after the first call
+ * that fails; otherwise failures are just recorded.
+ *
+ * Each call goes through syscall_dispatch with a copy of the
+ * trapframe loaded from its record, so it sees exactly the arguments
+ * it would in a trap of its own. For the ones that fetch arguments
+ * from the stack, the copy's sp is pointed 16 bytes before the
+ * record's sb_args[4], which puts those words where they'd be.
+ *
+ * Calls that need the real trapframe or replace the address space
+ * (fork and execv), and batch itself, can't be batched and fail with
+ * EINVAL.
+ */
+static
+int
+sys_batch(struct trapframe *tf, userptr_t recs, int nrecs, int flags,
+          int32_t *retval)
+{
+  struct trapframe btf;
+  struct sysbatch rec;
+  userptr_t urec;
+  int i, err = 0;
+
+  if (nrecs < 0 || (flags & ~BATCH_STOPONERR) != 0) {
+    return EINVAL;
+  }
+
+  for (i = 0; i < nrecs; i++) {
+    urec = recs + i * sizeof(struct sysbatch);
+    err = copyin(urec, &rec, sizeof(struct sysbatch));
+    if (err) {
+      break;
+    }
+
+    switch (rec.sb_callno) {
+      case SYS_fork:
+      case SYS_execv:
+      case SYS_batch:
+        rec.sb_retval = 0;
+        rec.sb_retval2 = 0;
+        rec.sb_errno = EINVAL;
+        break;
+      default:
+        btf = *tf;
+        btf.tf_v0 = rec.sb_callno;
+        btf.tf_a0 = rec.sb_args[0];
+        btf.tf_a1 = rec.sb_args[1];
+        btf.tf_a2 = rec.sb_args[2];
+        btf.tf_a3 = rec.sb_args[3];
+        btf.tf_sp = (vaddr_t)urec
+            + ((char *)&rec.sb_args[4] - (char *)&rec) - 16;
+        rec.sb_errno = syscall_dispatch(&btf, &rec.sb_retval,
+            &rec.sb_retval2);
+        break;
+    }
+
+    /* sb_retval, sb_retval2, and sb_errno are adjacent */
+    err = copyout(&rec.sb_retval,
+        urec + ((char *)&rec.sb_retval - (char *)&rec),
+        3 * sizeof(int));
+    if (err) {
+      break;
+    }
+
+    if (rec.sb_errno != 0 && (flags & BATCH_STOPONERR)) {
+      i++;
+      break;
+    }
+  }
+
+  /* a bad record is only an error if nothing ran before it */
+  if (err && i == 0) {
+    return err;
+  }
+
+  *retval = i;
+  return 0;
+}
+
 /*
  * Enter user mode for a newly forked process.
  */
@@ -216,12 +216,34 @@ as_create(void)
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
 
+	spinlock_init(&as->as_lock);
+	as->as_refcount = 1;
+
 	return as;
 }
 
+void
+as_incref(struct addrspace *as)
+{
+	spinlock_acquire(&as->as_lock);
+	as->as_refcount++;
+	spinlock_release(&as->as_lock);
+}
+
 void
 as_destroy(struct addrspace *as)
 {
+	unsigned refs;
+
+	spinlock_acquire(&as->as_lock);
+	KASSERT(as->as_refcount > 0);
+	refs = --as->as_refcount;
+	spinlock_release(&as->as_lock);
+	if (refs > 0) {
+		return;
+	}
+
+	spinlock_cleanup(&as->as_lock);
 	kfree(as);
 }
 
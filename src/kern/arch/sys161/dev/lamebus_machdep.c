@@ -31,6 +31,7 @@
 #include <kern/unistd.h>
 #include <lib.h>
 #include <mips/trapframe.h>
+#include <platform/maxcpus.h>
 #include <cpu.h>
 #include <spl.h>
 #include <clock.h>
@@ -41,6 +42,7 @@
 #include <sys161/bus.h>
 #include <lamebus/lamebus.h>
 #include "autoconf.h"
+#include "opt-lockstat.h"
 
 /*
  * CPU frequency used by the on-chip timer.
@@ -50,17 +52,35 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/* Cycles per hardclock. */
+#define TIMER_PERIOD (CPU_FREQUENCY / HZ)
+
 /*
  * Access to the on-chip timer.
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted. Writing to c0_compare again clears the interrupt, and
+ * restarts c0_count from zero.
+ *
+ * Since c0_count keeps getting reset, timer_cycles keeps the cycles
+ * counted before each reset, so that timer_cycles + c0_count is a
+ * cycle counter for the cpu. Only lock statistics use it.
  */
+#if OPT_LOCKSTAT
+static uint64_t timer_cycles[MAXCPUS];
+
+static uint32_t mips_timer_get(void);
+#endif
+
 static
 void
 mips_timer_set(uint32_t count)
 {
+#if OPT_LOCKSTAT
+	timer_cycles[curcpu->c_number] += mips_timer_get();
+#endif
+
 	/*
 	 * $11 == c0_compare; we can't use the symbolic name inside
 	 * the asm string.
@@ -73,6 +93,72 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Return the number of cycles this cpu has counted. Interrupts should
+ * be off, or the count might be reset between the two reads.
+ */
+uint64_t
+mainbus_cycles(void)
+{
+	return timer_cycles[curcpu->c_number] + mips_timer_get();
+}
+#endif
+
+/*
+ * Stretching the timer for tickless idle.
+ *
+ * Writing c0_compare restarts c0_count from zero, so to keep the
+ * ticks in phase we remember how far into the current tick each cpu
+ * was when its timer was stretched, and count from there.
+ */
+static uint32_t timer_phase[MAXCPUS];
+
+uint32_t
+mainbus_timer_stretch(unsigned nticks)
+{
+	uint32_t phase;
+
+	KASSERT(nticks >= 2);
+	KASSERT(nticks <= 0xffffffff / TIMER_PERIOD);
+
+	phase = mips_timer_get();
+	if (phase > TIMER_PERIOD) {
+		/* A tick is overdue; it's folded into the stretch. */
+		phase = TIMER_PERIOD;
+	}
+	timer_phase[curcpu->c_number] = phase;
+	mips_timer_set(nticks * TIMER_PERIOD - phase);
+
+	return phase * (1000000000 / CPU_FREQUENCY);
+}
+
+unsigned
+mainbus_timer_unstretch(void)
+{
+	uint32_t elapsed;
+
+	elapsed = timer_phase[curcpu->c_number] + mips_timer_get();
+	mips_timer_set(TIMER_PERIOD - elapsed % TIMER_PERIOD);
+	return elapsed / TIMER_PERIOD;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -113,7 +199,7 @@ mainbus_bootstrap(void)
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(TIMER_PERIOD);
 }
 
 /*
@@ -269,7 +355,7 @@ mainbus_interrupt(struct trapframe *tf)
 	}
 	else if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		mips_timer_set(TIMER_PERIOD);
 		/* and call hardclock */
 		hardclock();
 	}
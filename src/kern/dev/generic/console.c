@@ -52,11 +52,13 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
 #include <lib.h>
 #include <uio.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <poll.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -74,6 +76,11 @@ static struct con_softc *the_console = NULL;
 static struct lock *con_userlock_read = NULL;
 static struct lock *con_userlock_write = NULL;
 
+/*
+ * Pollers waiting for input.
+ */
+static struct pollq con_pollq;
+
 //////////////////////////////////////////////////
 
 /*
@@ -194,6 +201,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 		
 	V(cs->cs_rsem);
+	pollq_wakeup(&con_pollq);
 }
 
 /*
@@ -349,6 +357,32 @@ con_io(struct device *dev, struct uio *uio)
 	return 0;
 }
 
+/*
+ * Input is ready if there's anything in the buffer (it may not be a
+ * whole line, but a read returns what's there up to a newline);
+ * output is always ready.
+ *
+ * Input arrives in an interrupt handler, where we can't take a lock
+ * to make looking at the buffer atomic with registering. So register
+ * first, then look: anything that comes in after we look wakes us.
+ */
+static
+int
+con_poll(struct device *dev, int events, int *revents, struct pollwait *pw)
+{
+	struct con_softc *cs = dev->d_data;
+
+	if (pw != NULL) {
+		poll_register(pw, &con_pollq);
+	}
+
+	*revents = events & POLLOUT;
+	if (cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		*revents |= events & POLLIN;
+	}
+	return 0;
+}
+
 static
 int
 con_ioctl(struct device *dev, int op, userptr_t data)
@@ -376,6 +410,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_close = con_close;
 	dev->d_io = con_io;
 	dev->d_ioctl = con_ioctl;
+	dev->d_poll = con_poll;
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
 	dev->d_data = cs;
@@ -441,6 +476,7 @@ config_con(struct con_softc *cs, int unit)
 	cs->cs_wsem = wsem; 
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollq_init(&con_pollq);
 
 	the_console = cs;
 	con_userlock_read = rlk;
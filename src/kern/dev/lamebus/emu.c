@@ -1088,6 +1088,7 @@ static const struct vnode_ops emufs_fileops = {
 	emufs_stat,
 	emufs_file_gettype,
 	emufs_tryseek,
+	vnode_poll_ready,
 	emufs_fsync,
 	emufs_mmap,
 	emufs_truncate,
@@ -1123,6 +1124,7 @@ static const struct vnode_ops emufs_dirops = {
 	emufs_stat,
 	emufs_dir_gettype,
 	emufs_dir_tryseek,
+	vnode_poll_ready,
 	emufs_void_op_isdir,  /* fsync */
 	emufs_void_op_isdir,  /* mmap */
 	emufs_truncate_isdir,
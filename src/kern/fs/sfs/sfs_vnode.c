@@ -997,6 +997,58 @@ sfs_write(struct vnode *v, struct uio *uio)
 	return result;
 }
 
+/*
+ * Called for getdirentry(). The offset in the uio is a cookie: the
+ * number of the directory slot to start looking at. Empty slots are
+ * skipped, the name in the next used slot is handed back, and the
+ * offset is left at the slot after it, so each call returns exactly
+ * one entry. At the end of the directory nothing is transferred.
+ */
+static
+int
+sfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_dir sd;
+	int slot, nentries, result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	if (uio->uio_offset < 0) {
+		return EINVAL;
+	}
+
+	vfs_biglock_acquire();
+
+	nentries = sfs_dir_nentries(sv);
+	for (slot = uio->uio_offset; slot < nentries; slot++) {
+		result = sfs_readdir(sv, &sd, slot);
+		if (result) {
+			vfs_biglock_release();
+			return result;
+		}
+		if (sd.sfd_ino == SFS_NOINO) {
+			continue;
+		}
+
+		/* Ensure null termination, just in case */
+		sd.sfd_name[sizeof(sd.sfd_name)-1] = 0;
+		result = uiomove(sd.sfd_name, strlen(sd.sfd_name), uio);
+		if (result) {
+			vfs_biglock_release();
+			return result;
+		}
+		uio->uio_offset = slot + 1;
+		vfs_biglock_release();
+		return 0;
+	}
+
+	/* EOF; park the cookie at the end */
+	uio->uio_offset = nentries;
+	vfs_biglock_release();
+	return 0;
+}
+
 /*
  * Called for ioctl()
  */
@@ -1091,6 +1143,28 @@ sfs_tryseek(struct vnode *v, off_t pos)
 	return 0;
 }
 
+/*
+ * Check for legal seeks on directories. The offset of a directory is
+ * a slot cookie (see sfs_getdirentry), so allow anything from the
+ * start to the end of the directory; that covers rewinding and
+ * returning to a cookie saved earlier.
+ */
+static
+int
+sfs_dir_tryseek(struct vnode *v, off_t pos)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result = 0;
+
+	vfs_biglock_acquire();
+	if (pos < 0 || pos > sfs_dir_nentries(sv)) {
+		result = EINVAL;
+	}
+	vfs_biglock_release();
+
+	return result;
+}
+
 /*
  * Called for fsync(), and also on filesystem unmount, global sync(),
  * and some other cases.
@@ -1590,6 +1664,7 @@ static const struct vnode_ops sfs_fileops = {
 	sfs_stat,
 	sfs_gettype,
 	sfs_tryseek,
+	vnode_poll_ready,
 	sfs_fsync,
 	sfs_mmap,
 	sfs_truncate,
@@ -1619,12 +1694,13 @@ static const struct vnode_ops sfs_dirops = {
 	
 	ISDIR,   /* read */
 	ISDIR,   /* readlink */
-	UNIMP,   /* getdirentry */
+	sfs_getdirentry,
 	ISDIR,   /* write */
 	sfs_ioctl,
 	sfs_stat,
 	sfs_gettype,
-	UNIMP,   /* tryseek */
+	sfs_dir_tryseek,
+	vnode_poll_ready,
 	sfs_fsync,
 	ISDIR,   /* mmap */
 	ISDIR,   /* truncate */
@@ -36,6 +36,7 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
@@ -50,6 +51,13 @@ struct vnode;
  */
 
 struct addrspace {
+        /*
+         * User threads share one address space; it goes away when
+         * the last of them calls as_destroy. as_lock protects the
+         * refcount (and, outside dumbvm, the page table and heap).
+         */
+        struct spinlock as_lock;
+        unsigned as_refcount;
 #if OPT_DUMBVM
         vaddr_t as_vbase1;
         paddr_t as_pbase1;
@@ -85,8 +93,11 @@ struct addrspace {
  *                "seen" by the processor. Argument might be NULL, 
  *                meaning "no particular address space".
  *
- *    as_destroy - dispose of an address space. You may need to change
- *                the way this works if implementing user-level threads.
+ *    as_incref - add a reference to an address space, for another
+ *                thread that is going to share it.
+ *
+ *    as_destroy - drop a reference to an address space, disposing of
+ *                it when the last one goes away.
  *
  *    as_define_region - set up a region of memory within the address
  *                space.
@@ -105,6 +116,7 @@ struct addrspace {
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(struct addrspace *);
+void              as_incref(struct addrspace *);
 void              as_destroy(struct addrspace *);
 
 int               as_define_region(struct addrspace *as, 
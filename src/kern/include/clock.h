@@ -41,6 +41,9 @@
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
  *
+ * For anything finer-grained, use callouts, below, which run off
+ * hardclock and so have a resolution of 1/HZ seconds.
+ *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
  *
@@ -59,6 +62,15 @@
 void hardclock_bootstrap(void);
 
 void hardclock(void);
+
+/*
+ * Tickless idle: the idle loop calls clock_idle_enter just before
+ * idling the cpu, to turn off its periodic hardclock until something
+ * is due, and clock_idle_exit after, to turn it back on and catch up
+ * on the ticks that were skipped. Call with interrupts off.
+ */
+void clock_idle_enter(void);
+void clock_idle_exit(void);
 void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
@@ -70,8 +82,53 @@ void getinterval(time_t secs1, uint32_t nsecs,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ *
+ * clocksleep_ticks() is the same but takes a count of hardclocks.
  */
 void clocksleep(int seconds);
+void clocksleep_ticks(unsigned ticks);
+
+/*
+ * Callouts: functions to be called from the timer interrupt after a
+ * given number of hardclocks.
+ *
+ * The structure is public so callouts can be embedded in other
+ * objects rather than malloc'd, but only the callout functions should
+ * look inside it.
+ *
+ * callout_init	   Initialize a callout. It is not pending.
+ * callout_schedule Arrange for FUNC(ARG) to be called in TICKS
+ *		   hardclocks (0 means on the next one). If the callout
+ *		   is already pending it is rescheduled.
+ * callout_cancel  Stop a pending callout. Returns true if it was
+ *		   pending and now won't run. If the function is
+ *		   running right now, waits for it to finish, so once
+ *		   this returns the callout is no longer in use and can
+ *		   be freed.
+ * callout_pending Return true if the callout is scheduled.
+ *
+ * The function is called from the timer interrupt (or from the idle
+ * loop, catching up after tickless idle), on one cpu, with interrupts
+ * off and no locks held; it may not sleep.
+ *
+ * clock_ticks() returns the number of hardclocks the callout wheel
+ * has processed since boot.
+ */
+struct callout {
+	struct callout *co_next;	/* Next callout in the same slot */
+	struct callout **co_pprev;	/* Link to us; NULL if not pending */
+	uint32_t co_expire;		/* Tick at which to run */
+	void (*co_func)(void *);	/* Function to call */
+	void *co_arg;			/* Argument for co_func */
+};
+
+void callout_init(struct callout *co);
+void callout_schedule(struct callout *co, unsigned ticks,
+		      void (*func)(void *), void *arg);
+bool callout_cancel(struct callout *co);
+bool callout_pending(struct callout *co);
+
+uint32_t clock_ticks(void);
 
 
 #endif /* _CLOCK_H_ */
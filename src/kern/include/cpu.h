@@ -33,6 +33,7 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <thread.h>	/* for NPRIORITIES */
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
@@ -60,13 +61,19 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_slicestart;		/* c_hardclocks when curthread got cpu */
+	unsigned c_tickless;		/* Ticks idle timer is stretched to */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * c_isidle and c_runcount are also read without the lock, as
+	 * hints, when looking for a cpu to steal work from or wake up.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[NPRIORITIES]; /* Run queues, by priority */
+	unsigned c_runcount;		/* Threads on all run queues */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -99,12 +106,15 @@ struct cpu {
  *
  * cpu_create calls cpu_machdep_init.
  *
+ * cpu_count returns the number of cpus created so far.
+ *
  * cpu_start_secondary is the platform-dependent assembly language
  * entry point for new CPUs; it can be found in start.S. It calls
  * cpu_hatch after having claimed the startup stack and thread created
  * for the cpu.
  */
 struct cpu *cpu_create(unsigned hardware_number);
+unsigned cpu_count(void);
 void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
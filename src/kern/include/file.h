@@ -7,44 +7,75 @@
 #define _FILE_H_
 
 #include <limits.h>
+#include <spinlock.h>
 
 struct lock;
 struct vnode;
+struct aioctx;
 
 /*** openfile section ***/
 
 /* 
  * openfile struct 
  * note that there's not too much to keep track of, since the vnode does most
- * of that.  note that it does require synchronization, because a single
- * openfile can be shared between processes (filetable inheritance).
+ * of that.  a single openfile can be shared between processes (filetable
+ * inheritance), but only the offset ever changes, so of_lock covers just
+ * that, and only for objects that can seek at all.  the refcount is
+ * changed with atomic ops, so taking and dropping a reference never
+ * sleeps.
  */
 struct openfile {
 	struct vnode *of_vnode;
+	int of_accmode;	/* from open: O_RDONLY, O_WRONLY, or O_RDWR */
+	bool of_seekable;	/* false for devices and pipes: no offset */
 	
-	struct lock *of_lock;
+	struct lock *of_lock;	/* protects of_offset */
 	off_t of_offset;
-	int of_accmode;	/* from open: O_RDONLY, O_WRONLY, or O_RDWR */
-	int of_refcount;
+
+	volatile spinlock_data_t of_refcount;
+	struct openfile *of_limbo;	/* filetable's list of closed files */
 };
 
 /* opens a file (must be kernel pointers in the args) */
 int file_open(char *filename, int flags, int mode, int *retfd);
 
+/* puts an already-open vnode in the filetable */
+int file_openvnode(struct vnode *vn, int accmode, int *retfd);
+
 /* closes a file */
 int file_close(int fd);
 
+/* take and drop references to an openfile; the last drop closes it */
+void file_incref(struct openfile *file);
+void file_decref(struct openfile *file);
+
 
 /*** file table section ***/
 
 /*
  * filetable struct
- * just an array of open files.  nice and simple.  doesn't require
- * synchronization, because a table can only be owned by a single process (on
- * inheritance in fork, the table is copied).
+ * an array of open files, grown on demand up to OPEN_MAX, with a bitmap
+ * of which entries are in use.  a table belongs to a single process (on
+ * inheritance in fork, the table is copied), but all the threads of that
+ * process share it, so it's refcounted and ft_lock serializes changes
+ * to it.  looking up an fd doesn't take ft_lock: a lookup counts itself
+ * in ft_readers while it's looking, and whatever is taken out of the
+ * table goes on a limbo list, to be dropped or freed the next time
+ * ft_readers is seen to be 0.
  */
+struct ft_retired;
+
 struct filetable {
-	struct openfile *ft_openfiles[OPEN_MAX];
+	struct openfile **volatile ft_openfiles;	/* ft_size entries */
+	uint32_t *volatile ft_inuse;		/* one bit per entry */
+	volatile unsigned ft_size;	/* multiple of 32, at most OPEN_MAX */
+	volatile spinlock_data_t ft_readers;	/* lookups in progress */
+	struct spinlock ft_limbolock;	/* protects the next two */
+	struct openfile *volatile ft_limbo;	/* closed, not yet dropped */
+	struct ft_retired *volatile ft_retired;	/* old arrays, not freed */
+	struct lock *ft_lock;
+	int ft_refcount;
+	struct aioctx *ft_aio;		/* async i/o; NULL until first used */
 };
 
 /* these all have an implicit arg of the curthread's filetable */
@@ -52,8 +83,9 @@ int filetable_init(const char *inpath, const char *outpath,
 		   const char *errpath);
 int filetable_copy(struct filetable **copy);
 int filetable_placefile(struct openfile *file, int *fd);
-int filetable_findfile(int fd, struct openfile **file);
+int filetable_findfile(int fd, struct openfile **file);	/* takes a ref */
 int filetable_dup2file(int oldfd, int newfd);
-void filetable_destroy(struct filetable *ft);
+void filetable_incref(struct filetable *ft);
+void filetable_destroy(struct filetable *ft);	/* drops a reference */
 
 #endif /* _FILE_H_ */
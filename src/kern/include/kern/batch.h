@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_BATCH_H_
+#define _KERN_BATCH_H_
+
+/*
+ * Definitions for batch(), shared between the kernel and userland.
+ *
+ * Each record names a system call and gives its arguments exactly as
+ * they would be passed in a trap: sb_args[0-3] are the argument
+ * registers a0-a3 (with 64-bit values in aligned pairs, high word
+ * first), and sb_args[4-5] are the words that would be on the stack
+ * at sp+16. The kernel fills in the rest: sb_retval and sb_retval2
+ * get the values that would have been returned in v0 and v1, and
+ * sb_errno gets 0 on success or the error code.
+ */
+
+struct sysbatch {
+	int sb_callno;		/* system call number (SYS_*) */
+	__u32 sb_args[6];	/* arguments */
+	int sb_retval;		/* return value */
+	int sb_retval2;		/* low word of a 64-bit return value */
+	int sb_errno;		/* 0, or the error */
+};
+
+/* Flags for batch() */
+#define BATCH_STOPONERR	1	/* stop after the first call that fails */
+
+#endif /* _KERN_BATCH_H_ */
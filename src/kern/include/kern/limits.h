@@ -96,6 +96,9 @@
 /* Max number of iovec structures at once for readv/writev/preadv/pwritev */
 #define __IOV_MAX       1024
 
+/* Max outstanding aio_read/aio_write requests per process */
+#define __AIO_MAX       64
+
 /* 10 Feb 2004 : GWA : Required for shell */
 #define __NARG_MAX 1024
 
@@ -106,7 +109,7 @@
 /* max value for a process ID */
 #define __PID_MAX	32767
 
-/* max number of processes at once */
-#define __PROCS_MAX	128
+/* max number of processes at once (the pid table grows to hold them) */
+#define __PROCS_MAX	(__PID_MAX - __PID_MIN + 1)
 
 #endif /* _KERN_LIMITS_H_ */
@@ -50,5 +50,6 @@
 #define LOGIN_NAME_MAX  __LOGIN_NAME_MAX
 #define OPEN_MAX        __OPEN_MAX
 #define IOV_MAX         __IOV_MAX
+#define AIO_MAX         __AIO_MAX
 
 #endif /* _LIMITS_H_ */
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics.
+ *
+ * With the lockstat option, every spinlock, lock, and cv carries a
+ * struct lockstat recording how often it was acquired (for a cv,
+ * waited on), how often it was contended, how many cycles were spent
+ * spinning or blocked waiting for it, and the longest it was held.
+ * Each one joins a registry the first time it's used, so the lockstat
+ * menu command can print the most contended ones.
+ *
+ * The counters are updated only while holding the lock in question
+ * (for a cv, the lock used with it), so they need no locking of their
+ * own. Cycle counts come from the per-cpu cycle counter, so a thread
+ * that migrates while waiting for or holding a sleep lock can record
+ * a skewed time.
+ *
+ * Without the option none of this exists; the lock structures don't
+ * have the field and the lock code makes no calls.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+/* Kinds of lock */
+#define LOCKSTAT_SPINLOCK	0
+#define LOCKSTAT_LOCK		1
+#define LOCKSTAT_CV		2
+
+struct lockstat {
+	struct lockstat *ls_next;	/* Next in registry */
+	struct lockstat **ls_prevp;	/* Link to us; NULL if unregistered */
+	const char *ls_name;		/* Name, if the lock has one */
+	const void *ls_where;		/* Caller of first acquire */
+	unsigned ls_kind;		/* LOCKSTAT_* */
+	uint64_t ls_acquires;		/* Times acquired */
+	uint64_t ls_contended;		/* Times we had to wait */
+	uint64_t ls_waitcycles;		/* Cycles spent waiting */
+	uint64_t ls_holdstart;		/* Cycle count when last acquired */
+	uint64_t ls_maxhold;		/* Longest hold, in cycles */
+};
+
+#define LOCKSTAT_INITIALIZER(kind) \
+	{ NULL, NULL, NULL, NULL, kind, 0, 0, 0, 0, 0 }
+
+/*
+ * lockstat_init	Set up the stats for a lock of kind KIND. NAME
+ *			may be NULL.
+ * lockstat_cleanup	Remove the stats from the registry.
+ * lockstat_now		Read the cycle counter.
+ * lockstat_acquired	Record an acquisition that started waiting (or
+ *			not) at cycle START. WHERE is the caller's
+ *			address, used to identify unnamed locks.
+ * lockstat_released	Record a release, for the hold time.
+ * lockstat_print	Print the N most contended locks.
+ */
+void lockstat_init(struct lockstat *ls, unsigned kind, const char *name);
+void lockstat_cleanup(struct lockstat *ls);
+uint64_t lockstat_now(void);
+void lockstat_acquired(struct lockstat *ls, bool contended, uint64_t start,
+		       const void *where);
+void lockstat_released(struct lockstat *ls);
+void lockstat_print(unsigned n);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
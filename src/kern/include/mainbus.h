@@ -30,6 +30,8 @@
 #ifndef _MAINBUS_H_
 #define _MAINBUS_H_
 
+#include "opt-lockstat.h"
+
 /*
  * Abstract system bus interface.
  */
@@ -52,6 +54,25 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Stretch the current cpu's hardclock timer so the next interrupt
+ * comes NTICKS ticks after the last one instead of one, for tickless
+ * idle, returning how many nanoseconds into the current tick the cpu
+ * was; and put it back, returning the number of whole ticks that
+ * went by without an interrupt. Both keep the tick phase. Call with
+ * interrupts off.
+ */
+uint32_t mainbus_timer_stretch(unsigned nticks);
+unsigned mainbus_timer_unstretch(void);
+
+#if OPT_LOCKSTAT
+/*
+ * Cycle counter for the current cpu, for lock statistics. Counters on
+ * different cpus are not synchronized with each other.
+ */
+uint64_t mainbus_cycles(void);
+#endif
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
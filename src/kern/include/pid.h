@@ -37,7 +37,9 @@ void pid_setexitstatus(int status);
 
 /*
  * Causes the current thread to wait for the thread with pid PID to
- * exit, returning the exit status when it does.
+ * exit, returning the exit status when it does. PID may be WAIT_ANY
+ * to wait for whichever child exits first; the pid reaped is
+ * returned in RETPID.
  */
 int pid_wait(pid_t targetpid, int *status, int flags, pid_t *retpid);
 
@@ -0,0 +1,16 @@
+/*
+ * Pipes.
+ */
+
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+struct vnode;
+
+/*
+ * Create a pipe, handing back a vnode for each end. Both come back
+ * open; get rid of them with vfs_close.
+ */
+int pipe_create(struct vnode **readend, struct vnode **writeend);
+
+#endif /* _PIPE_H_ */
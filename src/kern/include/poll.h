@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Readiness notification for poll().
+ *
+ * Anything that can be polled, like a pipe or the console, embeds a
+ * struct pollq, and calls pollq_wakeup whenever it might have become
+ * readable or writable (or hung up). It's fine to call it when nothing
+ * changed; it's not fine to miss a change. pollq_wakeup may be called
+ * from an interrupt handler.
+ *
+ * Its vop_poll checks what's ready and, if given a pollwait, hangs the
+ * pollwait on its pollq with poll_register. To not miss a wakeup the
+ * check and the registration have to happen together, under whatever
+ * lock the object uses to protect the state that pollq_wakeup reports
+ * changes to.
+ *
+ * sys_poll makes a pollwait for each call, sized for the number of
+ * files, polls them all registering it, and if nothing is ready sleeps
+ * in pollwait_sleep until one of the objects calls pollq_wakeup. Then
+ * pollwait_clear takes it off all the pollqs before it looks again.
+ * The caller must keep the objects alive while the pollwait is hung on
+ * them.
+ */
+
+#include <spinlock.h>
+
+struct pollent;		/* Opaque */
+struct pollwait;	/* Opaque */
+
+struct pollq {
+	struct spinlock pq_lock;
+	struct pollent *pq_waiters;
+};
+
+void pollq_init(struct pollq *pq);
+void pollq_cleanup(struct pollq *pq);	/* must have no waiters */
+void pollq_wakeup(struct pollq *pq);
+
+void poll_register(struct pollwait *pw, struct pollq *pq);
+
+struct pollwait *pollwait_create(unsigned maxents);
+void pollwait_destroy(struct pollwait *pw);
+int pollwait_sleep(struct pollwait *pw, int ticks);	/* -1: forever */
+void pollwait_clear(struct pollwait *pw);
+
+#endif /* _POLL_H_ */
@@ -36,6 +36,7 @@
 
 
 #include <spinlock.h>
+#include <lockstat.h>
 
 /*
  * Dijkstra-style semaphore.
@@ -78,8 +79,11 @@ struct lock {
         // BEGIN SOLUTION
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
-        volatile struct thread *lk_holder;
+        struct thread *volatile lk_holder;   /* spun on in lock_acquire */
         // END SOLUTION
+#if OPT_LOCKSTAT
+        struct lockstat lk_stat;
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -88,7 +92,8 @@ void lock_acquire(struct lock *);
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. If the holder is running on another
+ *                   cpu, spins for a while before sleeping.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
@@ -121,6 +126,9 @@ struct cv {
         // BEGIN SOLUTION
         struct wchan *cv_wchan;
         // END SOLUTION
+#if OPT_LOCKSTAT
+        struct lockstat cv_stat;
+#endif
 };
 
 struct cv *cv_create(const char *name);
@@ -145,15 +153,46 @@ void cv_broadcast(struct cv *cv, struct lock *lock);
 
 /*
  * 13 Feb 2012 : GWA : Reader-writer locks.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ *
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it rather than keep it out forever. To keep readers from
+ * starving in turn, when a writer releases the lock it is handed to
+ * all the readers waiting at that point, if any, and otherwise to the
+ * next writer; when the last reader releases it, it's handed to a
+ * waiting writer. Handoff is direct: a thread that was woken already
+ * holds the lock and doesn't have to compete for it again.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
  */
 
 struct rwlock {
         char *rwlock_name;
+
+        struct spinlock rw_lock;        /* protects the fields below */
+        struct wchan *rw_readwchan;     /* readers waiting */
+        struct wchan *rw_writewchan;    /* writers waiting */
+        unsigned rw_readers;            /* readers holding the lock */
+        bool rw_writing;                /* a writer holds the lock */
+        unsigned rw_waitreaders;        /* readers on rw_readwchan */
+        unsigned rw_waitwriters;        /* writers on rw_writewchan */
 };
 
 struct rwlock * rwlock_create(const char *);
 void rwlock_destroy(struct rwlock *);
 
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give up a read hold on the lock.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Give up a write hold on the lock.
+ *
+ * The lock is not recursive; in particular a thread holding it for
+ * reading must not try to get it for writing.
+ */
 void rwlock_acquire_read(struct rwlock *);
 void rwlock_release_read(struct rwlock *);
 void rwlock_acquire_write(struct rwlock *);
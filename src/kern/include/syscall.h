@@ -32,6 +32,7 @@
 
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct aioctx;    /* from syscall/aio.c */
 
 /*
  * The system call dispatcher.
@@ -50,6 +51,9 @@ void enter_forked_process(struct trapframe *tf);
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);\
 
+/* Enter user mode in a new thread of an existing process. */
+void enter_new_thread(userptr_t arg, vaddr_t stackptr, vaddr_t entrypoint);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -59,22 +63,50 @@ int sys_open(userptr_t filename, int flags, int mode, int *retval);
 int sys_read(int fd, userptr_t buf, size_t size, int *retval);
 int sys_write(int fd, userptr_t buf, size_t size, int *retval);
 int sys_close(int fd);
+int sys_pread(int fd, userptr_t buf, size_t size, off_t offset, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t size, off_t offset, int *retval);
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_preadv(int fd, userptr_t iov, int iovcnt, off_t offset, int *retval);
+int sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t offset,
+		int *retval);
+int sys_pipe(userptr_t fds, int *retval);
+int sys_copy_file_range(int infd, userptr_t inpos, int outfd,
+			userptr_t outpos, size_t len, int *retval);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
 int sys_lseek(int fd, off_t offset, int32_t whence, off_t *retval);
+int sys_fstat(int fd, userptr_t statbuf);
+int sys_stat(userptr_t path, userptr_t statbuf);
+int sys_fsync(int fd);
+int sys_ftruncate(int fd, off_t len);
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
 int sys_chdir(userptr_t path);
 int sys___getcwd(userptr_t buf, size_t buflen, int *retval);
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t req, userptr_t rem);
 
 void sys__exit(int code);
 int sys_execv(userptr_t prog, userptr_t args);
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_spawn(userptr_t prog, userptr_t args, pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
-void execv_bootstrap(void);
-void execv_shutdown(void);
+int sys___threadfork(userptr_t entry, userptr_t arg, userptr_t stack,
+		     pid_t *retval);
 
 void* sys_sbrk(intptr_t change, vaddr_t *retval);
 
+int sys_futex_wait(userptr_t addr, int expected);
+int sys_futex_wake(userptr_t addr, int n, int *retval);
+void futex_bootstrap(void);
+
+int sys_aio_read(int fd, userptr_t buf, size_t len, off_t pos, int *retval);
+int sys_aio_write(int fd, userptr_t buf, size_t len, off_t pos, int *retval);
+int sys_aio_wait(int id, int *retval);
+void aio_bootstrap(void);
+void aioctx_destroy(struct aioctx *ctx);
+
 #endif /* _SYSCALL_H_ */
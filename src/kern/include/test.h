@@ -88,8 +88,11 @@ int threadtest2(int, char **);
 int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
+int lockbench(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int spinlockbench(int, char **);
+int clocktest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
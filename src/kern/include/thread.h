@@ -57,6 +57,13 @@ struct vnode;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Number of scheduler priority levels. Level 0 is the highest. With
+ * the default scheduler every thread stays at level 0, which makes
+ * the run queue plain FIFO.
+ */
+#define NPRIORITIES 4
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -81,10 +88,19 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	struct wchan *t_wchan;		/* Wait channel, if sleeping */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 
+	/*
+	 * Scheduler fields. Protected by the runqueue lock of t_cpu
+	 * while the thread is runnable.
+	 */
+	unsigned t_priority;		/* Run queue level, 0 = highest */
+	unsigned t_cpuclocks;		/* Hardclocks used at this level */
+	unsigned t_runstart;		/* c_hardclocks when last run */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -142,6 +158,26 @@ int thread_fork(const char *name,
                 void *data1, unsigned long data2, 
                 pid_t *childpid);
 
+/*
+ * Like thread_fork, but the new thread is another thread of the
+ * caller's process: it shares the address space and file table
+ * rather than getting copies. CHILDPID is required.
+ */
+int thread_fork_shared(const char *name,
+                       void (*func)(void *, unsigned long),
+                       void *data1, unsigned long data2,
+                       pid_t *childpid);
+
+/*
+ * Like thread_fork, but the new process runs in the address space AS,
+ * which the caller has already set up, instead of a copy of the
+ * caller's. Used by spawn.
+ */
+int thread_fork_as(const char *name,
+                   void (*func)(void *, unsigned long),
+                   void *data1, unsigned long data2,
+                   struct addrspace *as, pid_t *childpid);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -155,11 +191,23 @@ void thread_exit(int status);
  */
 void thread_yield(void);
 
+/*
+ * Return true if the current thread should yield the cpu: its
+ * timeslice is up, or a higher-priority thread is waiting. Called
+ * from the timer interrupt.
+ */
+bool thread_preempt_due(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
+/*
+ * Print the state of every CPU's run queues. Called from the menu.
+ */
+void schedule_printstats(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
@@ -33,6 +33,7 @@
 
 struct uio;
 struct stat;
+struct pollwait;
 
 /*
  * A struct vnode is an abstract representation of a file.
@@ -132,6 +133,14 @@ struct vnode {
  *                      past EOF on files whose sizes are fixed may be
  *                      as well.)
  *
+ *    vop_poll        - Set *REVENTS to which of the poll conditions in
+ *                      EVENTS (POLLIN, POLLOUT; see kern/poll.h) hold
+ *                      right now, plus POLLERR or POLLHUP if they do.
+ *                      If PW is not NULL, also register PW with
+ *                      poll_register so it's woken when that might
+ *                      change, atomically with the check. Objects
+ *                      that never block can use vnode_poll_ready.
+ *
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
@@ -208,6 +217,8 @@ struct vnode_ops {
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	int (*vop_tryseek)(struct vnode *object, off_t pos);
+	int (*vop_poll)(struct vnode *object, int events, int *revents,
+			struct pollwait *pw);
 	int (*vop_fsync)(struct vnode *object);
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
@@ -253,6 +264,7 @@ struct vnode_ops {
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
+#define VOP_POLL(vn, ev, rev, pw)       (__VOP(vn, poll)(vn, ev, rev, pw))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
@@ -312,5 +324,12 @@ void vnode_cleanup(struct vnode *);
 
 #define VOP_CLEANUP(vn)			vnode_cleanup(vn)
 
+/*
+ * vop_poll for objects that never block, like regular files: always
+ * ready for reading and writing.
+ */
+int vnode_poll_ready(struct vnode *v, int events, int *revents,
+		     struct pollwait *pw);
+
 
 #endif /* _VNODE_H_ */
@@ -41,6 +41,7 @@
 #include <syscall.h>
 #include <test.h>
 #include <pid.h>
+#include <lockstat.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -387,6 +388,42 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_runqueuestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	schedule_printstats();
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for printing the most contended locks.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	unsigned n = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [count]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		n = atoi(args[1]);
+	}
+
+	lockstat_print(n);
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -457,6 +494,9 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy5] CV test 2             (1)     ",
+	"[sy6] Lock contention bench (1)     ",
+	"[spb] Spinlock benchmark            ",
+	"[clk] Tickless clock test           ",
 	"[sp1] Whalematching Driver  (1)     ",
 	"[sp2] Stoplight Driver      (1)     ",
 	"[fs1] Filesystem test               ",
@@ -488,6 +528,10 @@ static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
 	"[kh] Kernel heap stats              ",
+	"[rq] Scheduler run queues           ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -536,6 +580,10 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "rq",		cmd_runqueuestats },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -554,6 +602,9 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy5",	cvtest2 },
+	{ "sy6",	lockbench },
+	{ "spb",	spinlockbench },
+	{ "clk",	clocktest },
 	
 #if OPT_SYNCHPROBS
   /* synchronization problem tests */
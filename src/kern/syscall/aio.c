@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Asynchronous I/O: aio_read, aio_write, and aio_wait.
+ *
+ * aio_read and aio_write queue a request and return an id right away;
+ * a small pool of kernel worker threads does the actual VOP_READ or
+ * VOP_WRITE, so a process can keep the disk busy while it computes,
+ * and keep several transfers in flight at once. aio_wait collects
+ * the result of one request.
+ *
+ * The workers have no address space of their own, so they never
+ * touch user memory: aio_write copies the data into a kernel buffer
+ * before queueing, and aio_read leaves the data in one for aio_wait
+ * to copy out. A request moves at most AIO_MAXIO bytes; as with read
+ * and write, asking for more just makes a short transfer. Only
+ * seekable objects are allowed, because every request is at an
+ * explicit offset and a worker shouldn't sit blocked on a pipe.
+ *
+ * Requests belong to the file table they were submitted through,
+ * which is what the threads of a process share, and are numbered by
+ * their slot in its aio context. Everything here is protected by the
+ * one aio_lock. If the file table goes away with requests still in
+ * flight, they're orphaned, and the worker that finishes each one
+ * frees it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <thread.h>
+#include <current.h>
+#include <vnode.h>
+#include <file.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define AIO_NWORKERS	4
+#define AIO_MAXIO	(64*1024)
+
+/*
+ * One request.
+ */
+struct aio_req {
+	struct aio_req *ar_next;	/* work queue link */
+	struct aioctx *ar_ctx;		/* owner, or NULL if orphaned */
+	struct openfile *ar_file;	/* referenced until done */
+	enum uio_rw ar_rw;
+	void *ar_kbuf;			/* the data */
+	size_t ar_len;
+	off_t ar_pos;
+	userptr_t ar_ubuf;		/* where aio_wait puts read data */
+	bool ar_done;
+	int ar_err;			/* once done: error, or 0 */
+	size_t ar_count;		/* once done: bytes transferred */
+};
+
+/*
+ * A process's outstanding requests, hung off its file table.
+ */
+struct aioctx {
+	struct aio_req *ac_reqs[AIO_MAX];
+	struct cv *ac_cv;		/* signalled when a request finishes */
+};
+
+static struct lock *aio_lock;
+static struct cv *aio_workcv;
+static struct aio_req *aio_head, *aio_tail;	/* work queue */
+
+static
+void
+aio_free(struct aio_req *req)
+{
+	KASSERT(req->ar_file == NULL);
+	kfree(req->ar_kbuf);
+	kfree(req);
+}
+
+/*
+ * Worker thread: take requests off the queue and do them.
+ */
+static
+void
+aio_worker(void *unused1, unsigned long unused2)
+{
+	struct aio_req *req;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		lock_acquire(aio_lock);
+		while (aio_head == NULL) {
+			cv_wait(aio_workcv, aio_lock);
+		}
+		req = aio_head;
+		aio_head = req->ar_next;
+		if (aio_head == NULL) {
+			aio_tail = NULL;
+		}
+		lock_release(aio_lock);
+
+		uio_kinit(&iov, &ku, req->ar_kbuf, req->ar_len, req->ar_pos,
+			  req->ar_rw);
+		if (req->ar_rw == UIO_READ) {
+			result = VOP_READ(req->ar_file->of_vnode, &ku);
+		}
+		else {
+			result = VOP_WRITE(req->ar_file->of_vnode, &ku);
+		}
+		file_decref(req->ar_file);
+		req->ar_file = NULL;
+
+		lock_acquire(aio_lock);
+		req->ar_err = result;
+		req->ar_count = req->ar_len - ku.uio_resid;
+		req->ar_done = true;
+		if (req->ar_ctx == NULL) {
+			lock_release(aio_lock);
+			aio_free(req);
+			continue;
+		}
+		cv_broadcast(req->ar_ctx->ac_cv, aio_lock);
+		lock_release(aio_lock);
+	}
+}
+
+/*
+ * Set up the queue and start the workers.
+ */
+void
+aio_bootstrap(void)
+{
+	unsigned i;
+	int result;
+
+	aio_lock = lock_create("aio");
+	aio_workcv = cv_create("aio work");
+	if (aio_lock == NULL || aio_workcv == NULL) {
+		panic("aio_bootstrap: Out of memory\n");
+	}
+	aio_head = aio_tail = NULL;
+
+	for (i=0; i<AIO_NWORKERS; i++) {
+		result = thread_fork("aio worker", aio_worker, NULL, 0, NULL);
+		if (result) {
+			panic("aio_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+/*
+ * Get the caller's aio context, making it if need be. Called with
+ * aio_lock held.
+ */
+static
+struct aioctx *
+aioctx_get(void)
+{
+	struct filetable *ft = curthread->t_filetable;
+	struct aioctx *ctx;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(aio_lock));
+
+	if (ft->ft_aio != NULL) {
+		return ft->ft_aio;
+	}
+
+	ctx = kmalloc(sizeof(struct aioctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+	ctx->ac_cv = cv_create("aio done");
+	if (ctx->ac_cv == NULL) {
+		kfree(ctx);
+		return NULL;
+	}
+	for (i=0; i<AIO_MAX; i++) {
+		ctx->ac_reqs[i] = NULL;
+	}
+
+	ft->ft_aio = ctx;
+	return ctx;
+}
+
+/*
+ * Called by filetable_destroy when the last reference to the table
+ * goes away. Nobody can be in aio_wait on it, so every request still
+ * here is either done, and can be freed, or still in the queue or a
+ * worker's hands, and gets orphaned.
+ */
+void
+aioctx_destroy(struct aioctx *ctx)
+{
+	struct aio_req *req;
+	unsigned i;
+
+	lock_acquire(aio_lock);
+	for (i=0; i<AIO_MAX; i++) {
+		req = ctx->ac_reqs[i];
+		if (req == NULL) {
+			continue;
+		}
+		ctx->ac_reqs[i] = NULL;
+		if (req->ar_done) {
+			aio_free(req);
+		}
+		else {
+			req->ar_ctx = NULL;
+		}
+	}
+	lock_release(aio_lock);
+
+	cv_destroy(ctx->ac_cv);
+	kfree(ctx);
+}
+
+/*
+ * Common code for aio_read and aio_write: check the file, make the
+ * request (copying in the data for a write), give it an id, and queue
+ * it.
+ */
+static
+int
+aio_submit(int fd, userptr_t buf, size_t len, off_t pos, enum uio_rw rw,
+	   int *retval)
+{
+	struct aio_req *req;
+	struct aioctx *ctx;
+	struct openfile *file;
+	int id, result;
+
+	if (pos < 0) {
+		return EINVAL;
+	}
+	if (len > AIO_MAXIO) {
+		len = AIO_MAXIO;
+	}
+
+	result = filetable_findfile(fd, &file);
+	if (result) {
+		return result;
+	}
+	if (file->of_accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+		file_decref(file);
+		return EBADF;
+	}
+	if (!file->of_seekable) {
+		file_decref(file);
+		return ESPIPE;
+	}
+
+	req = kmalloc(sizeof(struct aio_req));
+	if (req == NULL) {
+		file_decref(file);
+		return ENOMEM;
+	}
+	/* kmalloc(0) isn't allowed, but a zero-length request is */
+	req->ar_kbuf = kmalloc(len > 0 ? len : 1);
+	if (req->ar_kbuf == NULL) {
+		kfree(req);
+		file_decref(file);
+		return ENOMEM;
+	}
+	req->ar_next = NULL;
+	req->ar_file = file;
+	req->ar_rw = rw;
+	req->ar_len = len;
+	req->ar_pos = pos;
+	req->ar_ubuf = buf;
+	req->ar_done = false;
+	req->ar_err = 0;
+	req->ar_count = 0;
+
+	if (rw == UIO_WRITE) {
+		result = copyin(buf, req->ar_kbuf, len);
+		if (result) {
+			goto fail;
+		}
+	}
+
+	lock_acquire(aio_lock);
+
+	ctx = aioctx_get();
+	if (ctx == NULL) {
+		lock_release(aio_lock);
+		result = ENOMEM;
+		goto fail;
+	}
+	for (id=0; id<AIO_MAX; id++) {
+		if (ctx->ac_reqs[id] == NULL) {
+			break;
+		}
+	}
+	if (id == AIO_MAX) {
+		lock_release(aio_lock);
+		result = EAGAIN;
+		goto fail;
+	}
+	ctx->ac_reqs[id] = req;
+	req->ar_ctx = ctx;
+
+	if (aio_tail == NULL) {
+		aio_head = req;
+	}
+	else {
+		aio_tail->ar_next = req;
+	}
+	aio_tail = req;
+	cv_signal(aio_workcv, aio_lock);
+
+	lock_release(aio_lock);
+
+	*retval = id;
+	return 0;
+
+ fail:
+	file_decref(file);
+	req->ar_file = NULL;
+	aio_free(req);
+	return result;
+}
+
+int
+sys_aio_read(int fd, userptr_t buf, size_t len, off_t pos, int *retval)
+{
+	return aio_submit(fd, buf, len, pos, UIO_READ, retval);
+}
+
+int
+sys_aio_write(int fd, userptr_t buf, size_t len, off_t pos, int *retval)
+{
+	return aio_submit(fd, buf, len, pos, UIO_WRITE, retval);
+}
+
+/*
+ * aio_wait: wait for request ID to finish, and return what read or
+ * write would have. The id is released as soon as we claim the
+ * request, so a second wait on it fails instead of racing this one.
+ */
+int
+sys_aio_wait(int id, int *retval)
+{
+	struct aio_req *req;
+	struct aioctx *ctx;
+	int result;
+
+	if (id < 0 || id >= AIO_MAX) {
+		return EINVAL;
+	}
+
+	lock_acquire(aio_lock);
+	ctx = curthread->t_filetable->ft_aio;
+	if (ctx == NULL || ctx->ac_reqs[id] == NULL) {
+		lock_release(aio_lock);
+		return EINVAL;
+	}
+	req = ctx->ac_reqs[id];
+	ctx->ac_reqs[id] = NULL;
+	while (!req->ar_done) {
+		cv_wait(ctx->ac_cv, aio_lock);
+	}
+	lock_release(aio_lock);
+
+	result = req->ar_err;
+	if (result == 0 && req->ar_rw == UIO_READ) {
+		result = copyout(req->ar_kbuf, req->ar_ubuf, req->ar_count);
+	}
+	if (result == 0) {
+		*retval = req->ar_count;
+	}
+	aio_free(req);
+	return result;
+}
@@ -10,6 +10,7 @@
 #include <kern/unistd.h>
 #include <kern/fcntl.h>
 #include <lib.h>
+#include <spl.h>
 #include <synch.h>
 #include <uio.h>
 #include <thread.h>
@@ -19,6 +20,153 @@
 #include <file.h>
 #include <syscall.h>
 
+/*
+ * the table starts with room for FT_INITSIZE files and doubles when it
+ * fills, up to OPEN_MAX. which slots are in use is kept in a bitmap, one
+ * bit per slot, so finding the lowest free fd looks at one word per 32
+ * fds, and copying or tearing down a table skips empty words entirely.
+ * entries whose bit is clear are garbage; always check the bit first.
+ *
+ * lookups (filetable_findfile) don't take ft_lock, so changes are made
+ * in an order a lookup can cope with seeing halfway: an entry is filled
+ * in before its bit is set, and a new array is in place before ft_size
+ * says it's there. anything taken out of the table, an old array or an
+ * openfile, goes in limbo instead of being let go of, and limbo is
+ * emptied whenever ft_readers is seen to be 0: by whoever puts
+ * something in if there are no lookups going on, or else by the last
+ * lookup out (ft_reap). nobody waits for anybody.
+ */
+#define FT_BITS		32
+#define FT_ALLBITS	0xffffffff
+#define FT_INITSIZE	FT_BITS
+#define FT_NWORDS(size)	((size) / FT_BITS)
+
+/*
+ * ft_lowbit
+ * returns the index of the lowest set bit in W, which must not be 0.
+ */
+static
+unsigned
+ft_lowbit(uint32_t w)
+{
+	unsigned bit = 0;
+
+	KASSERT(w != 0);
+	if ((w & 0xffff) == 0) {
+		w >>= 16;
+		bit += 16;
+	}
+	if ((w & 0xff) == 0) {
+		w >>= 8;
+		bit += 8;
+	}
+	if ((w & 0xf) == 0) {
+		w >>= 4;
+		bit += 4;
+	}
+	if ((w & 0x3) == 0) {
+		w >>= 2;
+		bit += 2;
+	}
+	if ((w & 0x1) == 0) {
+		bit += 1;
+	}
+	return bit;
+}
+
+static
+bool
+ft_isopen(struct filetable *ft, int fd)
+{
+	KASSERT(fd >= 0);
+	if ((unsigned)fd >= ft->ft_size) {
+		return false;
+	}
+	return (ft->ft_inuse[fd / FT_BITS] & (1U << (fd % FT_BITS))) != 0;
+}
+
+static
+void
+ft_set(struct filetable *ft, int fd, struct openfile *file)
+{
+	KASSERT(fd >= 0 && (unsigned)fd < ft->ft_size);
+	ft->ft_openfiles[fd] = file;
+	membar_any_any();
+	ft->ft_inuse[fd / FT_BITS] |= 1U << (fd % FT_BITS);
+}
+
+static
+void
+ft_clear(struct filetable *ft, int fd)
+{
+	KASSERT(ft_isopen(ft, fd));
+	ft->ft_inuse[fd / FT_BITS] &= ~(1U << (fd % FT_BITS));
+	ft->ft_openfiles[fd] = NULL;
+}
+
+/*
+ * arrays replaced by ft_grow, waiting in limbo to be freed.
+ */
+struct ft_retired {
+	struct openfile **fr_files;
+	uint32_t *fr_inuse;
+	struct ft_retired *fr_next;
+};
+
+/*
+ * ft_reap
+ * if no lookup is in progress, none can be looking at anything in
+ * limbo, as it was all out of the table before now; so drop the files
+ * and free the arrays. otherwise leave them for the last lookup out.
+ */
+static
+void
+ft_reap(struct filetable *ft)
+{
+	struct openfile *file, *next;
+	struct ft_retired *fr, *frnext;
+
+	spinlock_acquire(&ft->ft_limbolock);
+	membar_any_any();
+	if (spinlock_data_get(&ft->ft_readers) != 0) {
+		spinlock_release(&ft->ft_limbolock);
+		return;
+	}
+	file = ft->ft_limbo;
+	ft->ft_limbo = NULL;
+	fr = ft->ft_retired;
+	ft->ft_retired = NULL;
+	spinlock_release(&ft->ft_limbolock);
+
+	for (; file != NULL; file = next) {
+		next = file->of_limbo;
+		file_decref(file);
+	}
+	for (; fr != NULL; fr = frnext) {
+		frnext = fr->fr_next;
+		kfree(fr->fr_files);
+		kfree(fr->fr_inuse);
+		kfree(fr);
+	}
+}
+
+/*
+ * ft_release
+ * drops the table's reference to FILE, just taken out of it, once no
+ * lookup can have it in hand.
+ */
+static
+void
+ft_release(struct filetable *ft, struct openfile *file)
+{
+	spinlock_acquire(&ft->ft_limbolock);
+	file->of_limbo = ft->ft_limbo;
+	ft->ft_limbo = file;
+	spinlock_release(&ft->ft_limbolock);
+
+	ft_reap(ft);
+}
+
 /*** openfile functions ***/
 
 /*
@@ -31,7 +179,6 @@ int
 file_open(char *filename, int flags, int mode, int *retfd)
 {
 	struct vnode *vn;
-	struct openfile *file;
 	int result;
 	
 	result = vfs_open(filename, flags, mode, &vn);
@@ -39,6 +186,21 @@ file_open(char *filename, int flags, int mode, int *retfd)
 		return result;
 	}
 
+	return file_openvnode(vn, flags & O_ACCMODE, retfd);
+}
+
+/*
+ * file_openvnode
+ * wraps an open vnode (from vfs_open, or the like) in an openfile with
+ * access mode ACCMODE, and places it in the filetable, setting RETFD to
+ * the file descriptor. on failure the vnode is closed.
+ */
+int
+file_openvnode(struct vnode *vn, int accmode, int *retfd)
+{
+	struct openfile *file;
+	int result;
+
 	file = kmalloc(sizeof(struct openfile));
 	if (file == NULL) {
 		vfs_close(vn);
@@ -54,8 +216,10 @@ file_open(char *filename, int flags, int mode, int *retfd)
 	}
 	file->of_vnode = vn;
 	file->of_offset = 0;
-	file->of_accmode = flags & O_ACCMODE;
+	file->of_accmode = accmode;
+	file->of_seekable = VOP_TRYSEEK(vn, 0) == 0;
 	file->of_refcount = 1;
+	file->of_limbo = NULL;
 
 	/* vfs_open checks for invalid access modes */
 	KASSERT(file->of_accmode==O_RDONLY ||
@@ -75,29 +239,33 @@ file_open(char *filename, int flags, int mode, int *retfd)
 }
 
 /*
- * file_doclose
- * shared code for file_close and filetable_destroy
+ * file_incref
+ * another filetable entry, or a syscall in progress, is using the file.
  */
-static
-int
-file_doclose(struct openfile *file)
+void
+file_incref(struct openfile *file)
 {
-	lock_acquire(file->of_lock);
+	spinlock_data_fetchinc(&file->of_refcount);
+}
 
-	/* if this is the last close of this file, free it up */
-	if (file->of_refcount == 1) {
+/*
+ * file_decref
+ * drops a reference; if it was the last one, closes the vnode and frees
+ * the file.
+ */
+void
+file_decref(struct openfile *file)
+{
+	spinlock_data_t old;
+
+	membar_any_any();
+	old = spinlock_data_fetchdec(&file->of_refcount);
+	KASSERT(old > 0);
+	if (old == 1) {
 		vfs_close(file->of_vnode);
-		lock_release(file->of_lock);
 		lock_destroy(file->of_lock);
 		kfree(file);
 	}
-	else {
-		KASSERT(file->of_refcount > 1);
-		file->of_refcount--;
-		lock_release(file->of_lock);
-	}
-
-	return 0;
 }
 
 /* 
@@ -107,30 +275,146 @@ file_doclose(struct openfile *file)
 int
 file_close(int fd)
 {
+	struct filetable *ft = curthread->t_filetable;
 	struct openfile *file;
-	int result;
 
-	/* find the file in the filetable */
-	result = filetable_findfile(fd, &file);
-	if (result) {
-		return result;
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
 	}
 
-	result = file_doclose(file);
-	if (result) {
-		/* leave file open for possible retry */
-		return result;
+	/* take the file out of the table, so no other thread can find it */
+	lock_acquire(ft->ft_lock);
+	if (!ft_isopen(ft, fd)) {
+		lock_release(ft->ft_lock);
+		return EBADF;
 	}
-	curthread->t_filetable->ft_openfiles[fd] = NULL;
+	file = ft->ft_openfiles[fd];
+	ft_clear(ft, fd);
+	lock_release(ft->ft_lock);
 
+	/* a lookup may have it in hand; drop it once none can */
+	ft_release(ft, file);
 	return 0;
 }
 
 /*** filetable functions ***/
 
+/*
+ * ft_create
+ * allocates an empty table with room for SIZE files.
+ */
+static
+struct filetable *
+ft_create(unsigned size)
+{
+	struct filetable *ft;
+
+	KASSERT(size % FT_BITS == 0 && size <= OPEN_MAX);
+
+	ft = kmalloc(sizeof(struct filetable));
+	if (ft == NULL) {
+		return NULL;
+	}
+	ft->ft_openfiles = kmalloc(size * sizeof(struct openfile *));
+	if (ft->ft_openfiles == NULL) {
+		kfree(ft);
+		return NULL;
+	}
+	ft->ft_inuse = kmalloc(FT_NWORDS(size) * sizeof(uint32_t));
+	if (ft->ft_inuse == NULL) {
+		kfree(ft->ft_openfiles);
+		kfree(ft);
+		return NULL;
+	}
+	ft->ft_lock = lock_create("filetable");
+	if (ft->ft_lock == NULL) {
+		kfree(ft->ft_inuse);
+		kfree(ft->ft_openfiles);
+		kfree(ft);
+		return NULL;
+	}
+	bzero(ft->ft_inuse, FT_NWORDS(size) * sizeof(uint32_t));
+	ft->ft_size = size;
+	ft->ft_readers = 0;
+	spinlock_init(&ft->ft_limbolock);
+	ft->ft_limbo = NULL;
+	ft->ft_retired = NULL;
+	ft->ft_refcount = 1;
+	ft->ft_aio = NULL;
+	return ft;
+}
+
+/*
+ * ft_grow
+ * makes the table big enough to hold fd MINSIZE-1, doubling its size as
+ * many times as it takes. the caller holds ft_lock.
+ */
+static
+int
+ft_grow(struct filetable *ft, unsigned minsize)
+{
+	struct openfile **newfiles;
+	uint32_t *newinuse;
+	struct ft_retired *fr;
+	unsigned newsize, i;
+
+	KASSERT(lock_do_i_hold(ft->ft_lock));
+	KASSERT(minsize <= OPEN_MAX);
+
+	if (minsize <= ft->ft_size) {
+		return 0;
+	}
+	newsize = ft->ft_size;
+	while (newsize < minsize) {
+		newsize *= 2;
+	}
+	if (newsize > OPEN_MAX) {
+		newsize = OPEN_MAX;
+	}
+
+	newfiles = kmalloc(newsize * sizeof(struct openfile *));
+	if (newfiles == NULL) {
+		return ENOMEM;
+	}
+	newinuse = kmalloc(FT_NWORDS(newsize) * sizeof(uint32_t));
+	if (newinuse == NULL) {
+		kfree(newfiles);
+		return ENOMEM;
+	}
+	fr = kmalloc(sizeof(struct ft_retired));
+	if (fr == NULL) {
+		kfree(newinuse);
+		kfree(newfiles);
+		return ENOMEM;
+	}
+
+	for (i = 0; i < ft->ft_size; i++) {
+		newfiles[i] = ft->ft_openfiles[i];
+	}
+	for (i = 0; i < FT_NWORDS(newsize); i++) {
+		newinuse[i] = i < FT_NWORDS(ft->ft_size) ? ft->ft_inuse[i] : 0;
+	}
+
+	fr->fr_files = ft->ft_openfiles;
+	fr->fr_inuse = ft->ft_inuse;
+	ft->ft_openfiles = newfiles;
+	ft->ft_inuse = newinuse;
+	membar_any_any();
+	ft->ft_size = newsize;
+
+	/* lookups may still be using the old arrays */
+	spinlock_acquire(&ft->ft_limbolock);
+	fr->fr_next = ft->ft_retired;
+	ft->ft_retired = fr;
+	spinlock_release(&ft->ft_limbolock);
+
+	ft_reap(ft);
+	return 0;
+}
+
 /* 
  * filetable_init
- * pretty straightforward -- allocate the space, initialize to NULL.
+ * pretty straightforward -- allocate a small empty table.
  * note that the one careful thing is to open the std i/o in order to
  * get
  * stdin  == 0
@@ -153,15 +437,10 @@ filetable_init(const char *inpath, const char *outpath, const char *errpath)
 	/* catch memory leaks, repeated calls */
 	KASSERT(curthread->t_filetable == NULL);
 
-	curthread->t_filetable = kmalloc(sizeof(struct filetable));
+	curthread->t_filetable = ft_create(FT_INITSIZE);
 	if (curthread->t_filetable == NULL) {
 		return ENOMEM;
 	}
-	
-	/* NULL-out the table */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		curthread->t_filetable->ft_openfiles[fd] = NULL;
-	}
 
 	/*
 	 * open the std fds.  note that the names must be copied into
@@ -193,13 +472,16 @@ filetable_init(const char *inpath, const char *outpath, const char *errpath)
  * again, pretty straightforward.  the subtle business here is that instead of
  * copying the openfile structure, we just increment the refcount.  this means
  * that openfile structs will, in fact, be shared between processes, as in
- * Unix.
+ * Unix. only the words of the bitmap with bits set are looked at, so
+ * this costs what's open, not what the table could hold.
  */
 int
 filetable_copy(struct filetable **copy)
 {
 	struct filetable *ft = curthread->t_filetable;
-	int fd;
+	struct openfile *file;
+	unsigned size, w, fd;
+	uint32_t bits;
 
 	/* waste of a call, really */
 	if (ft == NULL) {
@@ -207,90 +489,204 @@ filetable_copy(struct filetable **copy)
 		return 0;
 	}
 	
-	*copy = kmalloc(sizeof(struct filetable));
-	
-	if (*copy == NULL) {
-		return ENOMEM;
+	/*
+	 * the size can change while we aren't holding the lock, so check
+	 * it again after allocating.
+	 */
+	lock_acquire(ft->ft_lock);
+	while (1) {
+		size = ft->ft_size;
+		lock_release(ft->ft_lock);
+		*copy = ft_create(size);
+		if (*copy == NULL) {
+			return ENOMEM;
+		}
+		lock_acquire(ft->ft_lock);
+		if (ft->ft_size == size) {
+			break;
+		}
+		filetable_destroy(*copy);
 	}
 
 	/* copy over the entries */
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		if (ft->ft_openfiles[fd] != NULL) {
-			lock_acquire(ft->ft_openfiles[fd]->of_lock);
-			ft->ft_openfiles[fd]->of_refcount++;
-			lock_release(ft->ft_openfiles[fd]->of_lock);
-			(*copy)->ft_openfiles[fd] = ft->ft_openfiles[fd];
-		} 
-		else {
-			(*copy)->ft_openfiles[fd] = NULL;
+	for (w = 0; w < FT_NWORDS(ft->ft_size); w++) {
+		bits = ft->ft_inuse[w];
+		while (bits != 0) {
+			fd = w * FT_BITS + ft_lowbit(bits);
+			bits &= bits - 1;
+
+			file = ft->ft_openfiles[fd];
+			file_incref(file);
+			ft_set(*copy, fd, file);
 		}
 	}
+	lock_release(ft->ft_lock);
 
 	return 0;
 }
 
+/*
+ * filetable_incref
+ * another thread is going to share the table.
+ */
+void
+filetable_incref(struct filetable *ft)
+{
+	lock_acquire(ft->ft_lock);
+	ft->ft_refcount++;
+	lock_release(ft->ft_lock);
+}
+
 /*
  * filetable_destroy
- * closes the files in the file table, frees the table.
+ * drops a reference; when the last thread using the table lets go,
+ * closes the files in it and frees the table.
  */
 void
 filetable_destroy(struct filetable *ft)
 {
-	int fd, result;
+	unsigned w, fd;
+	uint32_t bits;
+	int refs;
 
 	KASSERT(ft != NULL);
 
-	for (fd = 0; fd < OPEN_MAX; fd++) {
-		if (ft->ft_openfiles[fd]) {
-			result = file_doclose(ft->ft_openfiles[fd]);
-			KASSERT(result==0);
+	lock_acquire(ft->ft_lock);
+	KASSERT(ft->ft_refcount > 0);
+	refs = --ft->ft_refcount;
+	lock_release(ft->ft_lock);
+	if (refs > 0) {
+		return;
+	}
+
+	for (w = 0; w < FT_NWORDS(ft->ft_size); w++) {
+		bits = ft->ft_inuse[w];
+		while (bits != 0) {
+			fd = w * FT_BITS + ft_lowbit(bits);
+			bits &= bits - 1;
+			file_decref(ft->ft_openfiles[fd]);
 		}
 	}
+
+	if (ft->ft_aio != NULL) {
+		aioctx_destroy(ft->ft_aio);
+	}
+
+	/* nobody else is using the table, so this empties limbo */
+	ft_reap(ft);
+	KASSERT(ft->ft_limbo == NULL && ft->ft_retired == NULL);
+	spinlock_cleanup(&ft->ft_limbolock);
 	
+	lock_destroy(ft->ft_lock);
+	kfree(ft->ft_inuse);
+	kfree(ft->ft_openfiles);
 	kfree(ft);
 }	
 
 /* 
  * filetable_placefile
  * finds the smallest available file descriptor, places the file at the point,
- * sets FD to it.
+ * sets FD to it. the first word of the bitmap that isn't full has the
+ * lowest free slot in it; if there isn't one, the table grows and the
+ * first new slot is the lowest.
  */
 int
 filetable_placefile(struct openfile *file, int *fd)
 {
 	struct filetable *ft = curthread->t_filetable;
-	int i;
+	unsigned w, i;
+	int result;
 	
-	for (i = 0; i < OPEN_MAX; i++) {
-		if (ft->ft_openfiles[i] == NULL) {
-			ft->ft_openfiles[i] = file;
-			*fd = i;
-			return 0;
+	lock_acquire(ft->ft_lock);
+	for (w = 0; w < FT_NWORDS(ft->ft_size); w++) {
+		if (ft->ft_inuse[w] != FT_ALLBITS) {
+			break;
 		}
 	}
+	if (w < FT_NWORDS(ft->ft_size)) {
+		i = w * FT_BITS + ft_lowbit(~ft->ft_inuse[w]);
+	}
+	else if (ft->ft_size < OPEN_MAX) {
+		i = ft->ft_size;
+		result = ft_grow(ft, i + 1);
+		if (result) {
+			lock_release(ft->ft_lock);
+			return result;
+		}
+	}
+	else {
+		lock_release(ft->ft_lock);
+		return EMFILE;
+	}
+	ft_set(ft, i, file);
+	lock_release(ft->ft_lock);
 
-	return EMFILE;
+	*fd = i;
+	return 0;
 }
 
 /*
  * filetable_findfile
  * verifies that the file descriptor is valid and actually references an
- * open file, setting the FILE to the file at that index if it's there.
+ * open file, setting the FILE to the file at that index if it's there,
+ * with a reference taken that the caller drops with file_decref. so
+ * another thread closing the fd meanwhile doesn't pull the file out from
+ * under the caller.
+ *
+ * this doesn't take ft_lock; it counts itself in ft_readers instead, so
+ * nothing it might see gets freed until it's done, and if it's the
+ * last lookup out it empties limbo (see ft_reap). interrupts are off
+ * while it's counted, so it can't be preempted and keep limbo full.
  */
 int
 filetable_findfile(int fd, struct openfile **file)
 {
 	struct filetable *ft = curthread->t_filetable;
+	struct openfile **files, *f;
+	uint32_t *inuse;
+	unsigned size;
+	spinlock_data_t readers;
+	int spl;
 
 	if (fd < 0 || fd >= OPEN_MAX) {
 		return EBADF;
 	}
 	
-	*file = ft->ft_openfiles[fd];
-	if (*file == NULL) {
-		return EBADF;
+	spl = splhigh();
+	spinlock_data_fetchinc(&ft->ft_readers);
+	membar_any_any();
+
+	/* if we see the new size, we see the new arrays too */
+	size = ft->ft_size;
+	membar_any_any();
+	files = ft->ft_openfiles;
+	inuse = ft->ft_inuse;
+
+	f = NULL;
+	if ((unsigned)fd < size &&
+	    (inuse[fd / FT_BITS] & (1U << (fd % FT_BITS))) != 0) {
+		membar_any_any();
+		f = files[fd];
+		/* NULL if it was closed since we looked at the bit */
+		if (f != NULL) {
+			file_incref(f);
+		}
 	}
 
+	membar_any_any();
+	readers = spinlock_data_fetchdec(&ft->ft_readers);
+	splx(spl);
+
+	membar_any_any();
+	if (readers == 1 &&
+	    (ft->ft_limbo != NULL || ft->ft_retired != NULL)) {
+		ft_reap(ft);
+	}
+
+	if (f == NULL) {
+		return EBADF;
+	}
+	*file = f;
 	return 0;
 }
 
@@ -304,38 +700,44 @@ int
 filetable_dup2file(int oldfd, int newfd)
 {
 	struct filetable *ft = curthread->t_filetable;
-	struct openfile *file;
+	struct openfile *file, *oldfile;
 	int result;
 
 	if (oldfd < 0 || oldfd >= OPEN_MAX || newfd < 0 || newfd >= OPEN_MAX) {
 		return EBADF;
 	}
 
-	file = ft->ft_openfiles[oldfd];
-	if (file == NULL) {
+	lock_acquire(ft->ft_lock);
+
+	if (!ft_isopen(ft, oldfd)) {
+		lock_release(ft->ft_lock);
 		return EBADF;
 	}
+	file = ft->ft_openfiles[oldfd];
 
 	/* dup2'ing an fd to itself automatically succeeds (BSD semantics) */
 	if (oldfd == newfd) {
+		lock_release(ft->ft_lock);
 		return 0;
 	}
 
-	/* closes the newfd if it's open */
-	if (ft->ft_openfiles[newfd] != NULL) {
-		result = file_close(newfd);
-		if (result) {
-			return result;
-		}
+	result = ft_grow(ft, newfd + 1);
+	if (result) {
+		lock_release(ft->ft_lock);
+		return result;
 	}
 
 	/* up the refcount */
-	lock_acquire(file->of_lock);
-	file->of_refcount++;
-	lock_release(file->of_lock);
+	file_incref(file);
 
-	/* doesn't need to be synchronized because it's just changing the ft */
-	ft->ft_openfiles[newfd] = file;
+	/* replace newfd, closing whatever was there once we're done */
+	oldfile = ft_isopen(ft, newfd) ? ft->ft_openfiles[newfd] : NULL;
+	ft_set(ft, newfd, file);
 
+	lock_release(ft->ft_lock);
+
+	if (oldfile != NULL) {
+		ft_release(ft, oldfile);
+	}
 	return 0;
 }
@@ -10,6 +10,7 @@
 #include <kern/unistd.h>
 #include <kern/fcntl.h>
 #include <kern/seek.h>
+#include <kern/poll.h>
 #include <lib.h>
 #include <synch.h>
 #include <uio.h>
@@ -18,8 +19,11 @@
 #include <vfs.h>
 #include <vnode.h>
 #include <file.h>
+#include <pipe.h>
 #include <syscall.h>
 #include <copyinout.h>
+#include <clock.h>
+#include <poll.h>
 
 /*
  * sys_open
@@ -40,15 +44,27 @@ sys_open(userptr_t filename, int flags, int mode, int *retval)
 }
 
 /*
- * sys_read
- * translates the fd into its openfile, then calls VOP_READ.
+ * file_rw
+ * common code for all the read and write calls: translates the fd into
+ * its openfile, then hands the uio's buffers to VOP_READ or VOP_WRITE in
+ * one go.
+ *
+ * if POSITIONAL is false, the i/o happens at the file's current offset,
+ * which is updated afterwards, so it's done holding the openfile's lock.
+ * if it's true (pread and friends), the offset given in the uio is used,
+ * the file's own offset is neither used nor changed, and the lock isn't
+ * needed: the accmode and vnode of an openfile never change, and the
+ * vnode protects itself. so i/o by processes sharing an openfile doesn't
+ * have to wait for each other. the same goes for plain reads and writes
+ * of things that can't seek, like the console and pipes, which have no
+ * offset to share.
  */
+static
 int
-sys_read(int fd, userptr_t buf, size_t size, int *retval)
+file_rw(int fd, struct uio *useruio, bool positional, int *retval)
 {
-  struct iovec iov;
-	struct uio useruio;
 	struct openfile *file;
+	size_t size;
 	int result;
 
 	/* better be a valid file descriptor */
@@ -57,87 +73,522 @@ sys_read(int fd, userptr_t buf, size_t size, int *retval)
 		return result;
 	}
 
-	lock_acquire(file->of_lock);
+	if (useruio->uio_rw == UIO_READ) {
+		if (file->of_accmode == O_WRONLY) {
+			file_decref(file);
+			return EBADF;
+		}
+	}
+	else {
+		if (file->of_accmode == O_RDONLY) {
+			file_decref(file);
+			return EBADF;
+		}
+	}
 
-	if (file->of_accmode == O_WRONLY) {
+	size = useruio->uio_resid;
+
+	if (positional) {
+		/* make sure the offset makes sense for this object */
+		result = VOP_TRYSEEK(file->of_vnode, useruio->uio_offset);
+		if (result) {
+			file_decref(file);
+			return result;
+		}
+	}
+	else if (!file->of_seekable) {
+		/* nothing to lock; the offset is ignored */
+		positional = true;
+	}
+	else {
+		lock_acquire(file->of_lock);
+		useruio->uio_offset = file->of_offset;
+	}
+
+	/* does the read or write */
+	if (useruio->uio_rw == UIO_READ) {
+		result = VOP_READ(file->of_vnode, useruio);
+	}
+	else {
+		result = VOP_WRITE(file->of_vnode, useruio);
+	}
+
+	if (!positional) {
+		if (result == 0) {
+			/* set the offset to the updated offset in the uio */
+			file->of_offset = useruio->uio_offset;
+		}
 		lock_release(file->of_lock);
-		return EBADF;
 	}
 
-	/* set up a uio with the buffer, its size, and the current offset */
-  uio_uinit(&iov, &useruio, buf, size, file->of_offset, UIO_READ);
-  
-  // mk_useruio(&useruio, buf, size, file->of_offset, UIO_READ);
+	file_decref(file);
 
-	/* does the read */
-	result = VOP_READ(file->of_vnode, &useruio);
 	if (result) {
-		lock_release(file->of_lock);
 		return result;
 	}
 
-	/* set the offset to the updated offset in the uio */
-	file->of_offset = useruio.uio_offset;
-
-	lock_release(file->of_lock);
-	
 	/*
-	 * The amount read is the size of the buffer originally, minus
-	 * how much is left in it.
+	 * The amount transferred is the size of the buffers originally,
+	 * minus how much is left in them.
 	 */
-	*retval = size - useruio.uio_resid;
+	*retval = size - useruio->uio_resid;
 
 	return 0;
 }
 
+/* the most a single read or write can report transferring */
+#define RW_MAX 0x7fffffff
+
 /*
- * sys_write
- * translates the fd into its openfile, then calls VOP_WRITE.
+ * copyin_iov
+ * copies in a user array of IOVCNT iovecs and sets up a uio for them,
+ * after checking the count and that the total length fits in the return
+ * value. the array goes in IOV if it fits (NIOV entries), otherwise in
+ * a kmalloc'd one handed back in *FREEME, which the caller must kfree
+ * when it's done with the uio.
  */
+static
 int
-sys_write(int fd, userptr_t buf, size_t size, int *retval)
+copyin_iov(userptr_t uiov, int iovcnt, struct iovec *iov, int niov,
+	   struct iovec **freeme, off_t pos, enum uio_rw rw,
+	   struct uio *useruio)
 {
-  struct iovec iov;
+	struct iovec *kiov;
+	size_t total;
+	int i, result;
+
+	*freeme = NULL;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	if (iovcnt <= niov) {
+		kiov = iov;
+	}
+	else {
+		kiov = kmalloc(iovcnt * sizeof(struct iovec));
+		if (kiov == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	result = copyin(uiov, kiov, iovcnt * sizeof(struct iovec));
+	if (result) {
+		goto fail;
+	}
+
+	/* the total has to fit in the (int) return value */
+	total = 0;
+	for (i=0; i<iovcnt; i++) {
+		if (kiov[i].iov_len > RW_MAX - total) {
+			result = EINVAL;
+			goto fail;
+		}
+		total += kiov[i].iov_len;
+	}
+
+	useruio->uio_iov = kiov;
+	useruio->uio_iovcnt = iovcnt;
+	useruio->uio_offset = pos;
+	useruio->uio_resid = total;
+	useruio->uio_segflg = UIO_USERSPACE;
+	useruio->uio_rw = rw;
+	useruio->uio_space = curthread->t_addrspace;
+
+	if (kiov != iov) {
+		*freeme = kiov;
+	}
+	return 0;
+
+fail:
+	if (kiov != iov) {
+		kfree(kiov);
+	}
+	return result;
+}
+
+/* iovecs that fit on the stack in readv and friends */
+#define NIOV_ONSTACK 8
+
+/*
+ * file_rwv
+ * common code for readv, writev, preadv, and pwritev.
+ */
+static
+int
+file_rwv(int fd, userptr_t uiov, int iovcnt, off_t pos, bool positional,
+	 enum uio_rw rw, int *retval)
+{
+	struct iovec iov[NIOV_ONSTACK], *freeme;
 	struct uio useruio;
-	struct openfile *file;
 	int result;
 
-	result = filetable_findfile(fd, &file);
+	result = copyin_iov(uiov, iovcnt, iov, NIOV_ONSTACK, &freeme,
+			    pos, rw, &useruio);
 	if (result) {
 		return result;
 	}
 
-	lock_acquire(file->of_lock);
+	result = file_rw(fd, &useruio, positional, retval);
 
-	if (file->of_accmode == O_RDONLY) {
-		lock_release(file->of_lock);
-		return EBADF;
+	if (freeme != NULL) {
+		kfree(freeme);
 	}
+	return result;
+}
 
-	/* set up a uio with the buffer, its size, and the current offset */
-  uio_uinit(&iov, &useruio, buf, size, file->of_offset, UIO_WRITE);
-	
-  //mk_useruio(&useruio, buf, size, file->of_offset, UIO_WRITE);
+/*
+ * sys_read
+ * read at the current offset.
+ */
+int
+sys_read(int fd, userptr_t buf, size_t size, int *retval)
+{
+	struct iovec iov;
+	struct uio useruio;
+
+	/* set up a uio with the buffer and its size */
+	uio_uinit(&iov, &useruio, buf, size, 0, UIO_READ);
+
+	return file_rw(fd, &useruio, false, retval);
+}
+
+/*
+ * sys_write
+ * write at the current offset.
+ */
+int
+sys_write(int fd, userptr_t buf, size_t size, int *retval)
+{
+	struct iovec iov;
+	struct uio useruio;
+
+	/* set up a uio with the buffer and its size */
+	uio_uinit(&iov, &useruio, buf, size, 0, UIO_WRITE);
+
+	return file_rw(fd, &useruio, false, retval);
+}
+
+/*
+ * sys_pread
+ * like sys_read, but at the offset given instead of the file's current
+ * offset, without the openfile lock. see file_rw.
+ */
+int
+sys_pread(int fd, userptr_t buf, size_t size, off_t offset, int *retval)
+{
+	struct iovec iov;
+	struct uio useruio;
+
+	/* set up a uio with the buffer, its size, and the caller's offset */
+	uio_uinit(&iov, &useruio, buf, size, offset, UIO_READ);
+
+	return file_rw(fd, &useruio, true, retval);
+}
 
-	/* does the write */
-	result = VOP_WRITE(file->of_vnode, &useruio);
+/*
+ * sys_pwrite
+ * like sys_write, but at the offset given; see sys_pread.
+ */
+int
+sys_pwrite(int fd, userptr_t buf, size_t size, off_t offset, int *retval)
+{
+	struct iovec iov;
+	struct uio useruio;
+
+	/* set up a uio with the buffer, its size, and the caller's offset */
+	uio_uinit(&iov, &useruio, buf, size, offset, UIO_WRITE);
+
+	return file_rw(fd, &useruio, true, retval);
+}
+
+/*
+ * sys_readv
+ * like sys_read, but scattering into several buffers. the whole vector
+ * goes to VOP_READ as a single uio.
+ */
+int
+sys_readv(int fd, userptr_t iov, int iovcnt, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, 0, false, UIO_READ, retval);
+}
+
+/*
+ * sys_writev
+ * like sys_write, but gathering from several buffers.
+ */
+int
+sys_writev(int fd, userptr_t iov, int iovcnt, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, 0, false, UIO_WRITE, retval);
+}
+
+/*
+ * sys_preadv
+ * readv at the offset given; see sys_pread.
+ */
+int
+sys_preadv(int fd, userptr_t iov, int iovcnt, off_t offset, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, offset, true, UIO_READ, retval);
+}
+
+/*
+ * sys_pwritev
+ * writev at the offset given; see sys_pread.
+ */
+int
+sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t offset, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, offset, true, UIO_WRITE, retval);
+}
+
+/* chunk size for copy_file_range; a multiple of any block size we have */
+#define COPY_CHUNK 4096
+
+/*
+ * copy_io
+ * reads or writes LEN bytes of the kernel buffer BUF from or to FILE at
+ * *POS, setting *DONE to how much was transferred. *POS is moved past
+ * that even if an error cut the transfer short, so it always agrees
+ * with *DONE. POS is NULL for things that can't seek, like pipes. the
+ * caller holds the lock for *POS, if it's the file's own offset.
+ */
+static
+int
+copy_io(struct openfile *file, off_t *pos, void *buf, size_t len,
+	enum uio_rw rw, size_t *done)
+{
+	struct iovec iov;
+	struct uio kuio;
+	int result;
+
+	uio_kinit(&iov, &kuio, buf, len, pos ? *pos : 0, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(file->of_vnode, &kuio);
+	}
+	else {
+		result = VOP_WRITE(file->of_vnode, &kuio);
+	}
+	*done = len - kuio.uio_resid;
+
+	if (pos != NULL) {
+		*pos = kuio.uio_offset;
+	}
+	return result;
+}
+
+/*
+ * copy_lock, copy_unlock
+ * take and drop the offset locks of the input and output files, either
+ * of which may be NULL if that file's own offset isn't being used. the
+ * two are taken in address order, so copies in opposite directions
+ * can't deadlock, and only once if the files share an openfile.
+ */
+static
+void
+copy_lock(struct lock *a, struct lock *b)
+{
+	struct lock *tmp;
+
+	if (a != NULL && b != NULL && a > b) {
+		tmp = a;
+		a = b;
+		b = tmp;
+	}
+	if (a != NULL) {
+		lock_acquire(a);
+	}
+	if (b != NULL && b != a) {
+		lock_acquire(b);
+	}
+}
+
+static
+void
+copy_unlock(struct lock *a, struct lock *b)
+{
+	if (a != NULL) {
+		lock_release(a);
+	}
+	if (b != NULL && b != a) {
+		lock_release(b);
+	}
+}
+
+/*
+ * sys_copy_file_range
+ * copies up to LEN bytes from INFD to OUTFD without the data coming out
+ * to userlevel. INPOS and OUTPOS, if not NULL, point to the offsets to
+ * use, which are updated, and the files' own offsets are left alone;
+ * if NULL, the files' own offsets are used and updated.
+ *
+ * the data goes through a kernel buffer in COPY_CHUNK pieces, and after
+ * the first piece each read starts on a COPY_CHUNK boundary of the
+ * input, so a filesystem can move whole blocks straight between the
+ * disk and the buffer. a file's own offset is locked for the whole of
+ * each piece, the read, the write and any give-back, so other users of
+ * the openfile never see it halfway.
+ *
+ * returns the number of bytes copied, which is 0 at end of file. if an
+ * error happens after some data was copied, the count is returned. the
+ * input offset only moves past what was actually written out, so a
+ * caller that copies in a loop doesn't lose anything on a short write.
+ * copying between overlapping ranges of the same file is EINVAL.
+ */
+int
+sys_copy_file_range(int infd, userptr_t uinpos, int outfd, userptr_t uoutpos,
+		    size_t len, int *retval)
+{
+	struct openfile *in, *out;
+	off_t inpos, outpos, instart, outstart;
+	off_t *inp, *outp;
+	struct lock *inlock, *outlock;
+	size_t total, chunk, got, put, wrote;
+	char *buf;
+	int result;
+
+	result = filetable_findfile(infd, &in);
 	if (result) {
-		lock_release(file->of_lock);
+		return result;
+	}
+	result = filetable_findfile(outfd, &out);
+	if (result) {
+		file_decref(in);
 		return result;
 	}
 
-	/* set the offset to the updated offset in the uio */
-	file->of_offset = useruio.uio_offset;
+	buf = NULL;
+	if (in->of_accmode == O_WRONLY || out->of_accmode == O_RDONLY) {
+		result = EBADF;
+		goto out;
+	}
 
-	lock_release(file->of_lock);
+	if (uinpos != NULL) {
+		result = copyin(uinpos, &inpos, sizeof(off_t));
+		if (result) {
+			goto out;
+		}
+		result = VOP_TRYSEEK(in->of_vnode, inpos);
+		if (result) {
+			goto out;
+		}
+	}
+	if (uoutpos != NULL) {
+		result = copyin(uoutpos, &outpos, sizeof(off_t));
+		if (result) {
+			goto out;
+		}
+		result = VOP_TRYSEEK(out->of_vnode, outpos);
+		if (result) {
+			goto out;
+		}
+	}
 
-	/*
-	 * the amount written is the size of the buffer originally,
-	 * minus how much is left in it.
-	 */
-	*retval = size - useruio.uio_resid;
+	/* which offsets to use, and the locks for them if they're shared */
+	inp = uinpos ? &inpos : (in->of_seekable ? &in->of_offset : NULL);
+	outp = uoutpos ? &outpos : (out->of_seekable ? &out->of_offset : NULL);
+	inlock = (uinpos == NULL && in->of_seekable) ? in->of_lock : NULL;
+	outlock = (uoutpos == NULL && out->of_seekable) ? out->of_lock : NULL;
 
-	return 0;
+	/* the count has to fit in the (int) return value */
+	if (len > RW_MAX) {
+		len = RW_MAX;
+	}
+
+	/* within one file, the copy would read back what it just wrote */
+	if (in->of_vnode == out->of_vnode && inp != NULL && outp != NULL) {
+		copy_lock(inlock, outlock);
+		instart = *inp;
+		outstart = *outp;
+		copy_unlock(inlock, outlock);
+		if (instart < outstart + (off_t)len &&
+		    outstart < instart + (off_t)len) {
+			result = EINVAL;
+			goto out;
+		}
+	}
+
+	buf = kmalloc(COPY_CHUNK);
+	if (buf == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	total = 0;
+	while (total < len) {
+		copy_lock(inlock, outlock);
+
+		/* line the reads up with the input's blocks */
+		chunk = COPY_CHUNK;
+		if (inp != NULL) {
+			chunk -= (size_t)(*inp % COPY_CHUNK);
+		}
+		if (chunk > len - total) {
+			chunk = len - total;
+		}
+
+		result = copy_io(in, inp, buf, chunk, UIO_READ, &got);
+		if (result || got == 0) {
+			copy_unlock(inlock, outlock);
+			break;
+		}
+
+		/* write all of it if we can; a short write may just be that */
+		put = 0;
+		while (put < got) {
+			result = copy_io(out, outp, buf + put, got - put,
+					 UIO_WRITE, &wrote);
+			put += wrote;
+			if (result || wrote == 0) {
+				break;
+			}
+		}
+		total += put;
+
+		/*
+		 * give back what was read but not written, so it's read
+		 * again next time instead of being skipped. that's not
+		 * possible for things that can't seek.
+		 */
+		if (put < got && inp != NULL) {
+			*inp -= got - put;
+		}
+
+		copy_unlock(inlock, outlock);
+		if (result || put < got) {
+			break;
+		}
+	}
+
+	/* a short copy isn't an error */
+	if (total > 0) {
+		result = 0;
+	}
+	if (result) {
+		goto out;
+	}
+
+	if (uinpos != NULL) {
+		result = copyout(&inpos, uinpos, sizeof(off_t));
+		if (result) {
+			goto out;
+		}
+	}
+	if (uoutpos != NULL) {
+		result = copyout(&outpos, uoutpos, sizeof(off_t));
+		if (result) {
+			goto out;
+		}
+	}
+	*retval = total;
+
+out:
+	kfree(buf);
+	file_decref(out);
+	file_decref(in);
+	return result;
 }
 
 /* 
@@ -181,31 +632,355 @@ sys_lseek(int fd, off_t offset, int32_t whence, off_t *retval)
 	    case SEEK_END:
 		result = VOP_STAT(file->of_vnode, &info);
 		if (result) {
-			lock_release(file->of_lock);
-			return result;
+			goto out;
 		}
 		*retval = info.st_size + offset;
 		break;
 	    default:
-		lock_release(file->of_lock);
-		return EINVAL;
+		result = EINVAL;
+		goto out;
 	}
 
 	/* try the seek -- if it fails, return */
 	result = VOP_TRYSEEK(file->of_vnode, *retval);
 	if (result) {
-		lock_release(file->of_lock);
-		return result;
+		goto out;
 	}
 	
 	/* success -- update the file structure */
 	file->of_offset = *retval;
 
+out:
+	lock_release(file->of_lock);
+	file_decref(file);
+	return result;
+}
+
+/*
+ * sys_fstat
+ * translates the fd into its openfile and stats the vnode.
+ */
+int
+sys_fstat(int fd, userptr_t statbuf)
+{
+	struct stat info;
+	struct openfile *file;
+	int result;
+
+	result = filetable_findfile(fd, &file);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_STAT(file->of_vnode, &info);
+	file_decref(file);
+	if (result) {
+		return result;
+	}
+
+	return copyout(&info, statbuf, sizeof(struct stat));
+}
+
+/*
+ * sys_stat
+ * the same as fstat, but by name, so checking a file's size or type
+ * doesn't take an open and a close as well. there are no symlinks, so
+ * this also serves as lstat.
+ */
+int
+sys_stat(userptr_t path, userptr_t statbuf)
+{
+	char pathbuf[PATH_MAX];
+	struct stat info;
+	struct vnode *vn;
+	int result;
+
+	result = copyinstr(path, pathbuf, sizeof(pathbuf), NULL);
+	if (result) {
+		return result;
+	}
+
+	result = vfs_lookup(pathbuf, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_STAT(vn, &info);
+	VOP_DECREF(vn);
+	if (result) {
+		return result;
+	}
+
+	return copyout(&info, statbuf, sizeof(struct stat));
+}
+
+/*
+ * sys_fsync
+ * translates the fd into its openfile and syncs the vnode.
+ */
+int
+sys_fsync(int fd)
+{
+	struct openfile *file;
+	int result;
+
+	result = filetable_findfile(fd, &file);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_FSYNC(file->of_vnode);
+	file_decref(file);
+	return result;
+}
+
+/*
+ * sys_ftruncate
+ * translates the fd into its openfile and, if it was opened for
+ * writing, truncates the vnode to LEN.
+ */
+int
+sys_ftruncate(int fd, off_t len)
+{
+	struct openfile *file;
+	int result;
+
+	if (len < 0) {
+		return EINVAL;
+	}
+
+	result = filetable_findfile(fd, &file);
+	if (result) {
+		return result;
+	}
+
+	if (file->of_accmode == O_RDONLY) {
+		file_decref(file);
+		return EINVAL;
+	}
+
+	result = VOP_TRUNCATE(file->of_vnode, len);
+	file_decref(file);
+	return result;
+}
+
+/*
+ * sys_getdirentry
+ * reads the next name out of a directory into BUF. the file's offset is
+ * whatever cookie the filesystem hands back, so unlike read it's always
+ * used under the openfile's lock, whether or not the directory can be
+ * seeked. returns the length of the name, or 0 at the end.
+ */
+int
+sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval)
+{
+	struct iovec iov;
+	struct uio useruio;
+	struct openfile *file;
+	int result;
+
+	result = filetable_findfile(fd, &file);
+	if (result) {
+		return result;
+	}
+
+	if (file->of_accmode == O_WRONLY) {
+		file_decref(file);
+		return EBADF;
+	}
+
+	lock_acquire(file->of_lock);
+
+	uio_uinit(&iov, &useruio, buf, buflen, file->of_offset, UIO_READ);
+	result = VOP_GETDIRENTRY(file->of_vnode, &useruio);
+	if (result == 0) {
+		file->of_offset = useruio.uio_offset;
+		*retval = buflen - useruio.uio_resid;
+	}
+
 	lock_release(file->of_lock);
+	file_decref(file);
+
+	return result;
+}
+
+/*
+ * sys_pipe
+ * makes a pipe, opens its read and write ends as two new file descriptors,
+ * and copies the descriptors out to FDS.
+ */
+int
+sys_pipe(userptr_t fds, int *retval)
+{
+	struct vnode *readvn, *writevn;
+	int kfds[2];
+	int result;
+
+	result = pipe_create(&readvn, &writevn);
+	if (result) {
+		return result;
+	}
+
+	result = file_openvnode(readvn, O_RDONLY, &kfds[0]);
+	if (result) {
+		vfs_close(writevn);
+		return result;
+	}
 
+	result = file_openvnode(writevn, O_WRONLY, &kfds[1]);
+	if (result) {
+		file_close(kfds[0]);
+		return result;
+	}
+
+	result = copyout(kfds, fds, sizeof(kfds));
+	if (result) {
+		file_close(kfds[0]);
+		file_close(kfds[1]);
+		return result;
+	}
+
+	*retval = 0;
 	return 0;
 }
 
+/*
+ * poll_scan
+ * checks each of the NFDS files once, filling in revents, and registers
+ * PW with each one if it's not NULL. returns how many are ready.
+ */
+static
+int
+poll_scan(struct pollfd *pfds, struct openfile **files, unsigned nfds,
+	  struct pollwait *pw)
+{
+	unsigned i;
+	int revents, nready, result;
+
+	nready = 0;
+	for (i=0; i<nfds; i++) {
+		if (pfds[i].fd < 0) {
+			pfds[i].revents = 0;
+			continue;
+		}
+		if (files[i] == NULL) {
+			pfds[i].revents = POLLNVAL;
+			nready++;
+			continue;
+		}
+		result = VOP_POLL(files[i]->of_vnode, pfds[i].events,
+				  &revents, pw);
+		if (result) {
+			revents = POLLERR;
+		}
+		pfds[i].revents = revents;
+		if (revents != 0) {
+			nready++;
+		}
+	}
+	return nready;
+}
+
+/*
+ * sys_poll
+ * looks at all the files, and if none is ready, sleeps until one of
+ * them says something changed, or the timeout passes, then looks
+ * again. the openfiles are held for the whole call, so the vnodes
+ * we're registered with can't go away under us even if another thread
+ * closes the fds.
+ */
+int
+sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval)
+{
+	struct pollfd *pfds;
+	struct openfile **files;
+	struct pollwait *pw;
+	uint32_t deadline;
+	int32_t left;
+	unsigned i;
+	int nready, result;
+
+	if (nfds > OPEN_MAX) {
+		return EINVAL;
+	}
+
+	/* (the +1 is so nfds == 0, which just sleeps, still works) */
+	pfds = kmalloc(nfds * sizeof(struct pollfd) + 1);
+	files = kmalloc(nfds * sizeof(struct openfile *) + 1);
+	if (files != NULL) {
+		for (i=0; i<nfds; i++) {
+			files[i] = NULL;
+		}
+	}
+	pw = pollwait_create(nfds);
+	if (pfds == NULL || files == NULL || pw == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	result = copyin(ufds, pfds, nfds * sizeof(struct pollfd));
+	if (result) {
+		goto out;
+	}
+	for (i=0; i<nfds; i++) {
+		if (pfds[i].fd >= 0 &&
+		    filetable_findfile(pfds[i].fd, &files[i])) {
+			files[i] = NULL;
+		}
+	}
+
+	/* round the timeout up to whole hardclocks */
+	deadline = 0;
+	if (timeout > 0) {
+		deadline = clock_ticks() +
+			((uint64_t)timeout * HZ + 999) / 1000;
+	}
+
+	while (1) {
+		nready = poll_scan(pfds, files, nfds, timeout != 0 ? pw : NULL);
+		if (nready > 0 || timeout == 0) {
+			break;
+		}
+
+		if (timeout > 0) {
+			left = (int32_t)(deadline - clock_ticks());
+			if (left <= 0) {
+				break;
+			}
+			result = pollwait_sleep(pw, left);
+		}
+		else {
+			result = pollwait_sleep(pw, -1);
+		}
+		pollwait_clear(pw);
+		if (result == ETIMEDOUT) {
+			/* one last look, without registering */
+			timeout = 0;
+		}
+	}
+	pollwait_clear(pw);
+
+	result = copyout(pfds, ufds, nfds * sizeof(struct pollfd));
+	if (result == 0) {
+		*retval = nready;
+	}
+
+out:
+	if (files != NULL) {
+		for (i=0; i<nfds; i++) {
+			if (files[i] != NULL) {
+				file_decref(files[i]);
+			}
+		}
+		kfree(files);
+	}
+	if (pw != NULL) {
+		pollwait_destroy(pw);
+	}
+	kfree(pfds);
+	return result;
+}
+
 /* 
  * sys_dup2
  * just pass the work off to the filetable
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes: user-level blocking on a word of user memory.
+ *
+ * A futex is named by the address space and virtual address of an
+ * aligned 32-bit word. (There are no shared mappings, so that pair
+ * is unique; threads that share an address space share futexes.)
+ * Sleepers are kept in a small hash table of buckets. Each bucket
+ * has a sleep lock that serializes the value check in futex_wait
+ * against futex_wake, and one wait channel that every sleeper in
+ * the bucket sleeps on. A wakeup marks the waiters it chose and
+ * wakes the whole channel; anyone not chosen (a hash collision)
+ * just goes back to sleep.
+ *
+ * The lock is a sleep lock rather than a spinlock because reading
+ * the user's word with copyin can fault.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS	32
+
+/*
+ * One sleeping thread. Lives on the sleeper's stack.
+ */
+struct futex_waiter {
+	struct futex_waiter *fw_next;
+	struct addrspace *fw_as;
+	vaddr_t fw_addr;
+	bool fw_woken;
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct wchan *fb_wchan;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_buckets[FUTEX_NBUCKETS];
+
+/*
+ * Create the buckets.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_buckets[i].fb_lock = lock_create("futex");
+		futex_buckets[i].fb_wchan = wchan_create("futex");
+		if (futex_buckets[i].fb_lock == NULL ||
+		    futex_buckets[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_buckets[i].fb_waiters = NULL;
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	uintptr_t key;
+
+	key = (addr >> 2) ^ ((uintptr_t)as >> 4);
+	key ^= key >> 5;
+	return &futex_buckets[key % FUTEX_NBUCKETS];
+}
+
+/*
+ * futex_wait: if the word at ADDR still holds EXPECTED, sleep until
+ * a futex_wake on the same address picks us. Returns EAGAIN if the
+ * value had already changed, which callers treat the same as a
+ * wakeup.
+ */
+int
+sys_futex_wait(userptr_t addr, int expected)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw;
+	int32_t val;
+	int result;
+
+	if ((vaddr_t)addr % sizeof(int32_t) != 0) {
+		return EINVAL;
+	}
+
+	fw.fw_next = NULL;
+	fw.fw_as = curthread->t_addrspace;
+	fw.fw_addr = (vaddr_t)addr;
+	fw.fw_woken = false;
+
+	fb = futex_hash(fw.fw_as, fw.fw_addr);
+	lock_acquire(fb->fb_lock);
+
+	result = copyin(addr, &val, sizeof(val));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (val != expected) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+
+	fw.fw_next = fb->fb_waiters;
+	fb->fb_waiters = &fw;
+
+	/*
+	 * As in cv_wait: lock the channel before dropping the bucket
+	 * lock so a waker can't slip in between.
+	 */
+	while (!fw.fw_woken) {
+		wchan_lock(fb->fb_wchan);
+		lock_release(fb->fb_lock);
+		wchan_sleep(fb->fb_wchan);
+		lock_acquire(fb->fb_lock);
+	}
+
+	/* futex_wake already took us off the list. */
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+/*
+ * futex_wake: wake up to N threads sleeping in futex_wait on ADDR.
+ * Returns the number woken.
+ */
+int
+sys_futex_wake(userptr_t addr, int n, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **fwp, *fw;
+	struct addrspace *as;
+	int count;
+
+	if ((vaddr_t)addr % sizeof(int32_t) != 0) {
+		return EINVAL;
+	}
+	if (n < 0) {
+		return EINVAL;
+	}
+
+	as = curthread->t_addrspace;
+	fb = futex_hash(as, (vaddr_t)addr);
+	count = 0;
+
+	lock_acquire(fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && count < n) {
+		fw = *fwp;
+		if (fw->fw_as == as && fw->fw_addr == (vaddr_t)addr) {
+			*fwp = fw->fw_next;
+			fw->fw_next = NULL;
+			fw->fw_woken = true;
+			count++;
+		}
+		else {
+			fwp = &fw->fw_next;
+		}
+	}
+	if (count > 0) {
+		wchan_wakeall(fb->fb_wchan);
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = count;
+	return 0;
+}
@@ -94,6 +94,69 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	return 0;
 }
 
+/*
+ * sys___threadfork
+ *
+ * create a new thread in the current process. It shares our address
+ * space and file table, and starts at ENTRY with ARG as its argument
+ * and STACK as its stack pointer. The user-level library allocates
+ * the stack. The new thread gets its own pid, so thread exit and join
+ * are just _exit and waitpid.
+ */
+
+struct threadstart {
+	vaddr_t ts_entry;
+	vaddr_t ts_arg;
+	vaddr_t ts_stack;
+};
+
+static
+void
+user_thread(void *vts, unsigned long junk)
+{
+	struct threadstart ts;
+
+	(void)junk;
+
+	ts = *(struct threadstart *)vts;
+	kfree(vts);
+
+	enter_new_thread((userptr_t)ts.ts_arg, ts.ts_stack, ts.ts_entry);
+}
+
+int
+sys___threadfork(userptr_t entry, userptr_t arg, userptr_t stack,
+		 pid_t *retval)
+{
+	struct threadstart *ts;
+	int result;
+
+	/* the mips ABI wants 8-byte aligned stacks */
+	if ((vaddr_t)entry % 4 != 0 || (vaddr_t)stack % 8 != 0) {
+		return EINVAL;
+	}
+	if (entry == NULL || stack == NULL) {
+		return EFAULT;
+	}
+
+	ts = kmalloc(sizeof(struct threadstart));
+	if (ts == NULL) {
+		return ENOMEM;
+	}
+	ts->ts_entry = (vaddr_t)entry;
+	ts->ts_arg = (vaddr_t)arg;
+	ts->ts_stack = (vaddr_t)stack;
+
+	result = thread_fork_shared(curthread->t_name, user_thread, ts, 0,
+				    retval);
+	if (result) {
+		kfree(ts);
+		return result;
+	}
+
+	return 0;
+}
+
 /*
  * sys_waitpid
  * just pass off the work to the pid code.
@@ -108,6 +171,10 @@ sys_waitpid(pid_t pid, userptr_t retstatus, int flags, pid_t *retval)
 	if (result) {
 		return result;
 	}
+	if (*retval == 0) {
+		/* WNOHANG and nothing has exited yet */
+		return 0;
+	}
   status = _MKWAIT_EXIT(status);	
 	return copyout(&status, retstatus, sizeof(int));
 }
@@ -123,14 +190,21 @@ sys_sbrk(intptr_t change,vaddr_t  *retval)
  // if(reminder < 0){
    //  change -= (PAGE_SIZE + reminder);
  // }
-  if(curthread->t_addrspace->heap_end + change < curthread->t_addrspace->heap_start){
+  struct addrspace *as = curthread->t_addrspace;
+
+  /* other threads in the process may be moving the break too */
+  spinlock_acquire(&as->as_lock);
+  if(as->heap_end + change < as->heap_start){
+	  spinlock_release(&as->as_lock);
 	  return (void *)EINVAL;
   }
-  if(curthread->t_addrspace->heap_end + change -curthread->t_addrspace->heap_start > HEAP_MAX_SIZE){
+  if(as->heap_end + change - as->heap_start > HEAP_MAX_SIZE){
+	  spinlock_release(&as->as_lock);
 	  return (void *) ENOMEM;
   }
-  *retval = curthread->t_addrspace->heap_end;
-  curthread->t_addrspace->heap_end += change;
+  *retval = as->heap_end;
+  as->heap_end += change;
+  spinlock_release(&as->as_lock);
 
   return (void*) 0;
 }
@@ -13,7 +13,6 @@
 #include <limits.h>
 #include <kern/errno.h>
 #include <lib.h>
-#include <synch.h>
 #include <addrspace.h>
 #include <thread.h>
 #include <current.h>
@@ -27,34 +26,119 @@
 
 /*
  * argvdata struct
- * temporary storage for argv, global and synchronized.  this is because
- * a large number of simultaneous execv's could bring the system to its knees
- * with a huge number of kmallocs (and even reasonable sized command lines
- * might not fit on the stack).
+ * temporary storage for argv while it's moved from the old image to the
+ * new one. each exec has its own, so execs don't wait for each other.
+ * the buffers start small and grow as the args are copied in, so the
+ * usual short command line doesn't cost an ARG_MAX-sized allocation.
  */
 struct argvdata {
 	char *buffer;
 	char *bufend;
+	size_t bufsize;
 	size_t *offsets;
+	int maxargs;
 	int nargs;
-	struct lock *lock;
 };
 
-static struct argvdata argdata;
+/* starting sizes for argvdata; enough for most command lines */
+#define ARGV_INITBUF   512
+#define ARGV_INITARGS  16
 
-void
-execv_bootstrap(void)
+/*
+ * argvdata_init
+ * set up an empty argvdata with the starting buffer sizes.
+ */
+static
+int
+argvdata_init(struct argvdata *ad)
 {
-	argdata.lock = lock_create("arglock");
-	if (argdata.lock == NULL) {
-		panic("Cannot create argv data lock\n");
+	ad->bufsize = ARGV_INITBUF;
+	ad->buffer = kmalloc(ad->bufsize);
+	if (ad->buffer == NULL) {
+		return ENOMEM;
 	}
+	ad->maxargs = ARGV_INITARGS;
+	ad->offsets = kmalloc(ad->maxargs * sizeof(size_t));
+	if (ad->offsets == NULL) {
+		kfree(ad->buffer);
+		return ENOMEM;
+	}
+	ad->bufend = ad->buffer;
+	ad->nargs = 0;
+	return 0;
 }
 
+/*
+ * argvdata_cleanup
+ * free the argvdata buffers.
+ */
+static
 void
-execv_shutdown(void)
+argvdata_cleanup(struct argvdata *ad)
+{
+	kfree(ad->buffer);
+	kfree(ad->offsets);
+}
+
+/*
+ * argvdata_growbuf
+ * double the size of the string buffer, up to ARG_MAX.
+ */
+static
+int
+argvdata_growbuf(struct argvdata *ad)
+{
+	char *newbuf;
+	size_t newsize, used;
+
+	if (ad->bufsize >= ARG_MAX) {
+		return E2BIG;
+	}
+	newsize = ad->bufsize * 2;
+	if (newsize > ARG_MAX) {
+		newsize = ARG_MAX;
+	}
+
+	newbuf = kmalloc(newsize);
+	if (newbuf == NULL) {
+		return ENOMEM;
+	}
+	used = ad->bufend - ad->buffer;
+	memcpy(newbuf, ad->buffer, used);
+	kfree(ad->buffer);
+
+	ad->buffer = newbuf;
+	ad->bufend = newbuf + used;
+	ad->bufsize = newsize;
+	return 0;
+}
+
+/*
+ * argvdata_growoffsets
+ * double the size of the offsets array, up to NARG_MAX.
+ */
+static
+int
+argvdata_growoffsets(struct argvdata *ad)
 {
-	lock_destroy(argdata.lock);
+	size_t *newoffsets;
+	int newmax;
+
+	newmax = ad->maxargs * 2;
+	if (newmax > NARG_MAX) {
+		newmax = NARG_MAX;
+	}
+
+	newoffsets = kmalloc(newmax * sizeof(size_t));
+	if (newoffsets == NULL) {
+		return ENOMEM;
+	}
+	memcpy(newoffsets, ad->offsets, ad->nargs * sizeof(size_t));
+	kfree(ad->offsets);
+
+	ad->offsets = newoffsets;
+	ad->maxargs = newmax;
+	return 0;
 }
 
 /*
@@ -68,14 +152,9 @@ copyin_args(userptr_t argv, struct argvdata *ad)
 {
 	userptr_t argptr;
 	size_t arglen;
-	size_t bufsize, bufresid;
+	size_t bufresid;
 	int result;
 
-	KASSERT(lock_do_i_hold(ad->lock));
-
-	/* for convenience */
-	bufsize = bufresid = ARG_MAX;
-
 	/* reset the argvdata */
 	ad->bufend = ad->buffer;
 
@@ -100,20 +179,40 @@ copyin_args(userptr_t argv, struct argvdata *ad)
 		if (ad->nargs >= NARG_MAX) {
 			return E2BIG;
 		}
+
+		/* out of offsets? get more */
+		if (ad->nargs >= ad->maxargs) {
+			result = argvdata_growoffsets(ad);
+			if (result) {
+				return result;
+			}
+		}
 		 
-		/* otherwise, copyinstr the arg into the argvdata buffer */
-		result = copyinstr(argptr, ad->bufend, bufresid, &arglen);
-		if (result == ENAMETOOLONG) {
-			return E2BIG;
+		/*
+		 * otherwise, copyinstr the arg into the argvdata buffer.
+		 * if it doesn't fit, grow the buffer and try again; the
+		 * buffer won't grow past ARG_MAX, so if it still doesn't
+		 * fit then, it's too big.
+		 */
+		while (1) {
+			bufresid = ad->bufsize - (ad->bufend - ad->buffer);
+			result = copyinstr(argptr, ad->bufend, bufresid,
+					   &arglen);
+			if (result != ENAMETOOLONG) {
+				break;
+			}
+			result = argvdata_growbuf(ad);
+			if (result) {
+				return result;
+			}
 		}
-		else if (result) {
+		if (result) {
 			return result;
 		}
 		
 		/* got one -- update the argvdata and the local argv userptr */
-		ad->offsets[ad->nargs] = bufsize - bufresid;
+		ad->offsets[ad->nargs] = ad->bufend - ad->buffer;
 		ad->bufend += arglen;
-		bufresid -= arglen;
 		argv += sizeof(userptr_t);
 	}
 
@@ -134,8 +233,6 @@ copyout_args(struct argvdata *ad, userptr_t *argv, vaddr_t *stackptr)
 	size_t buflen;
 	int i, result;
 
-	KASSERT(lock_do_i_hold(ad->lock));
-
 	/* we use the buflen a lot, precalc it */
 	buflen = ad->bufend - ad->buffer;
 	
@@ -197,28 +294,24 @@ copyout_args(struct argvdata *ad, userptr_t *argv, vaddr_t *stackptr)
 }
 
 /*
- * loadexec
- * common code for execv and runprogram: loading the executable
+ * loadimage
+ * common code for execv, runprogram, and spawn: load the executable into
+ * a new address space. on success the current thread is left running in
+ * the new address space, and the old one is handed back in OLDVMP for
+ * the caller to either destroy or switch back to.
  */
 static
 int
-loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
+loadimage(char *path, struct addrspace **oldvmp, vaddr_t *entrypoint,
+	  vaddr_t *stackptr)
 {
 	struct addrspace *newvm, *oldvm;
 	struct vnode *v;
-	char *newname;
 	int result;
 
-	/* new name for thread */
-	newname = kstrdup(path);
-	if (newname == NULL) {
-		return ENOMEM;
-	}
-
 	/* open the file. */
 	result = vfs_open(path, O_RDONLY, (mode_t) 0, &v);
 	if (result) {
-		kfree(newname);
 		return result;
 	}
 
@@ -226,7 +319,6 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 	newvm = as_create();
 	if (newvm == NULL) {
 		vfs_close(v);
-		kfree(newname);
 		return ENOMEM;
 	}
 
@@ -244,7 +336,6 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 		curthread->t_addrspace = oldvm;
 		as_activate(curthread->t_addrspace);
 		as_destroy(newvm);
-		kfree(newname);
 		return result;
 	}
 
@@ -257,6 +348,33 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 		curthread->t_addrspace = oldvm;
 		as_activate(curthread->t_addrspace);
 		as_destroy(newvm);
+		return result;
+	}
+
+	*oldvmp = oldvm;
+	return 0;
+}
+
+/*
+ * loadexec
+ * common code for execv and runprogram: loading the executable
+ */
+static
+int
+loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
+{
+	struct addrspace *oldvm;
+	char *newname;
+	int result;
+
+	/* new name for thread */
+	newname = kstrdup(path);
+	if (newname == NULL) {
+		return ENOMEM;
+	}
+
+	result = loadimage(path, &oldvm, entrypoint, stackptr);
+	if (result) {
 		kfree(newname);
 		return result;
 	}
@@ -295,6 +413,7 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 int
 runprogram(char *progname)
 {
+	struct argvdata argdata;
 	vaddr_t entrypoint, stackptr;
 	int argc;
 	userptr_t argv;
@@ -306,25 +425,22 @@ runprogram(char *progname)
 	/* we should be a new thread. */
 	KASSERT(curthread->t_addrspace == NULL);
 
-	lock_acquire(argdata.lock);
-
 	/* make up argv strings */
 
 	if (strlen(progname) + 1 > ARG_MAX) {
-		lock_release(argdata.lock);
 		return E2BIG;
 	}
 	
 	/* allocate the space */
-	argdata.buffer = kmalloc(strlen(progname) + 1);
+	argdata.bufsize = strlen(progname) + 1;
+	argdata.buffer = kmalloc(argdata.bufsize);
 	if (argdata.buffer == NULL) {
-		lock_release(argdata.lock);
 		return ENOMEM;
 	}
+	argdata.maxargs = 1;
 	argdata.offsets = kmalloc(sizeof(size_t));
 	if (argdata.offsets == NULL) {
 		kfree(argdata.buffer);
-		lock_release(argdata.lock);
 		return ENOMEM;
 	}
 	
@@ -337,17 +453,13 @@ runprogram(char *progname)
 	/* load the executable. note: must not fail after this succeeds. */
 	result = loadexec(progname, &entrypoint, &stackptr);
 	if (result) {
-		kfree(argdata.buffer);
-		kfree(argdata.offsets);
-		lock_release(argdata.lock);
+		argvdata_cleanup(&argdata);
 		return result;
 	}
 
 	result = copyout_args(&argdata, &argv, &stackptr);
 	if (result) {
-		kfree(argdata.buffer);
-		kfree(argdata.offsets);
-		lock_release(argdata.lock);
+		argvdata_cleanup(&argdata);
 
 		/* If copyout fails, *we* messed up, so panic */
 		panic("execv: copyout_args failed: %s\n", strerror(result));
@@ -356,10 +468,7 @@ runprogram(char *progname)
 	argc = argdata.nargs;
 
 	/* free the space */
-	kfree(argdata.buffer);
-	kfree(argdata.offsets);
-
-	lock_release(argdata.lock);
+	argvdata_cleanup(&argdata);
 
 	/* warp to user mode. */
 	enter_new_process(argc, argv, stackptr, entrypoint);
@@ -380,6 +489,7 @@ runprogram(char *progname)
 int
 sys_execv(userptr_t prog, userptr_t argv)
 {
+	struct argvdata argdata;
 	char *path;
 	vaddr_t entrypoint, stackptr;
 	int argc;
@@ -396,30 +506,18 @@ sys_execv(userptr_t prog, userptr_t argv)
 
 	/* get the argv strings. */
 
-	lock_acquire(argdata.lock);
-	
 	/* allocate the space */
-	argdata.buffer = kmalloc(ARG_MAX);
-	if (argdata.buffer == NULL) {
-		lock_release(argdata.lock);
-		kfree(path);
-		return ENOMEM;
-	}
-	argdata.offsets = kmalloc(NARG_MAX * sizeof(size_t));
-	if (argdata.offsets == NULL) {
-		kfree(argdata.buffer);
-		lock_release(argdata.lock);
+	result = argvdata_init(&argdata);
+	if (result) {
 		kfree(path);
-		return ENOMEM;
+		return result;
 	}
 	
 	/* do the copyin */
 	result = copyin_args(argv, &argdata);
 	if (result) {
 		kfree(path);
-		kfree(argdata.buffer);
-		kfree(argdata.offsets);
-		lock_release(argdata.lock);
+		argvdata_cleanup(&argdata);
 		return result;
 	}
 
@@ -427,9 +525,7 @@ sys_execv(userptr_t prog, userptr_t argv)
 	result = loadexec(path, &entrypoint, &stackptr);
 	if (result) {
 		kfree(path);
-		kfree(argdata.buffer);
-		kfree(argdata.offsets);
-		lock_release(argdata.lock);
+		argvdata_cleanup(&argdata);
 		return result;
 	}
 
@@ -439,18 +535,13 @@ sys_execv(userptr_t prog, userptr_t argv)
 	/* send the argv strings to the process. */
 	result = copyout_args(&argdata, &argv, &stackptr);
 	if (result) {
-		lock_release(argdata.lock);
-
 		/* if copyout fails, *we* messed up, so panic */
 		panic("execv: copyout_args failed: %s\n", strerror(result));
 	}
 	argc = argdata.nargs;
 
 	/* free the argdata space */	
-	kfree(argdata.buffer);
-	kfree(argdata.offsets);
-	
-	lock_release(argdata.lock);
+	argvdata_cleanup(&argdata);
 
 	/* warp to user mode. */
 	enter_new_process(argc, argv, stackptr, entrypoint);
@@ -459,3 +550,128 @@ sys_execv(userptr_t prog, userptr_t argv)
 	panic("md_usermode returned\n");
 	return EINVAL;
 }
+
+/*
+ * spawnstart struct
+ * what a spawned process needs to get to user mode. by the time it runs,
+ * its parent has already loaded the image and copied out the argv.
+ */
+struct spawnstart {
+	vaddr_t ss_entrypoint;
+	vaddr_t ss_stackptr;
+	userptr_t ss_argv;
+	int ss_argc;
+};
+
+static
+void
+spawn_child(void *vss, unsigned long junk)
+{
+	struct spawnstart ss;
+
+	(void)junk;
+
+	ss = *(struct spawnstart *)vss;
+	kfree(vss);
+
+	/* warp to user mode. */
+	enter_new_process(ss.ss_argc, ss.ss_argv, ss.ss_stackptr,
+			  ss.ss_entrypoint);
+
+	/* md_usermode does not return */
+	panic("md_usermode returned\n");
+}
+
+/*
+ * sys_spawn
+ * fork and execv in one step, without copying the caller's address
+ * space only to throw the copy away.
+ * 1. copyin the program name and argv, as for execv
+ * 2. load the executable into a new address space, borrowing it as our
+ *    own just long enough to fill it in and copyout_args the argv
+ * 3. switch back to our own address space
+ * 4. fork a child that gets a copy of our file table but the new
+ *    address space, and goes straight to usermode.
+ * since all the loading happens here, errors come back to the caller
+ * just like they would from execv.
+ */
+int
+sys_spawn(userptr_t prog, userptr_t argv, pid_t *retval)
+{
+	struct argvdata argdata;
+	struct addrspace *newvm, *oldvm;
+	struct spawnstart *ss;
+	char *path;
+	int result;
+
+	ss = kmalloc(sizeof(struct spawnstart));
+	if (ss == NULL) {
+		return ENOMEM;
+	}
+
+	path = kmalloc(PATH_MAX);
+	if (path == NULL) {
+		kfree(ss);
+		return ENOMEM;
+	}
+
+	/* get the filename. */
+	result = copyinstr(prog, path, PATH_MAX, NULL);
+	if (result) {
+		goto fail_path;
+	}
+
+	/* get the argv strings. */
+
+	/* allocate the space */
+	result = argvdata_init(&argdata);
+	if (result) {
+		goto fail_path;
+	}
+
+	/* do the copyin */
+	result = copyin_args(argv, &argdata);
+	if (result) {
+		goto fail_args;
+	}
+
+	/* load the executable. this leaves us running in the new image. */
+	result = loadimage(path, &oldvm, &ss->ss_entrypoint, &ss->ss_stackptr);
+	if (result) {
+		goto fail_args;
+	}
+
+	/* send the argv strings to the new image. */
+	result = copyout_args(&argdata, &ss->ss_argv, &ss->ss_stackptr);
+	ss->ss_argc = argdata.nargs;
+
+	/* put our own address space back either way */
+	newvm = curthread->t_addrspace;
+	curthread->t_addrspace = oldvm;
+	as_activate(curthread->t_addrspace);
+
+	if (result) {
+		as_destroy(newvm);
+		goto fail_args;
+	}
+
+	/* free the argdata space */
+	argvdata_cleanup(&argdata);
+
+	result = thread_fork_as(path, spawn_child, ss, 0, newvm, retval);
+	kfree(path);
+	if (result) {
+		as_destroy(newvm);
+		kfree(ss);
+		return result;
+	}
+
+	return 0;
+
+fail_args:
+	argvdata_cleanup(&argdata);
+fail_path:
+	kfree(path);
+	kfree(ss);
+	return result;
+}
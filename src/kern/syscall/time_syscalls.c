@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,54 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/* Nanoseconds per hardclock. */
+#define NS_PER_TICK	(1000000000 / HZ)
+
+/* Longest sleep we'll do in one go, in seconds, so ticks can't overflow. */
+#define NANOSLEEP_MAXSECS	(0x7fffffff / HZ)
+
+/*
+ * Sleep for the requested time, rounded up to the next hardclock.
+ *
+ * Nothing can interrupt the sleep (we don't have signals), so if the
+ * caller asks for the remaining time it is always zero.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req;
+	unsigned ticks;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+	if (req.tv_sec > NANOSLEEP_MAXSECS) {
+		req.tv_sec = NANOSLEEP_MAXSECS;
+	}
+
+	ticks = req.tv_sec * HZ + (req.tv_nsec + NS_PER_TICK - 1) / NS_PER_TICK;
+	if (ticks > 0) {
+		/*
+		 * We're somewhere in the middle of the current tick;
+		 * add one so we never sleep short.
+		 */
+		clocksleep_ticks(ticks + 1);
+	}
+
+	if (user_rem != NULL) {
+		req.tv_sec = 0;
+		req.tv_nsec = 0;
+		result = copyout(&req, user_rem, sizeof(req));
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tickless clock test.
+ *
+ * Checks that the tick count, and sleeps measured in ticks, keep up
+ * with real time on other cpus while the callout cpu (cpu 0) is
+ * tickless-idle and not advancing the callout wheel itself. Forks a
+ * thread per cpu; any that land on cpu 0 exit right away so it goes
+ * idle, and the rest spin for a while watching clock_ticks() and
+ * then sleep, checking both against the real-time clock. The threads
+ * aren't bound to cpus, so this needs at least one to land elsewhere.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define CLK_MAXTHREADS	32
+#define CLK_SPINTICKS	(HZ / 2)	/* how long to watch the clock */
+#define CLK_SLEEPTICKS	(HZ / 4)	/* how long to sleep */
+#define CLK_NSPERTICK	(1000000000 / HZ)
+
+static volatile bool clk_go;
+static unsigned clk_ran;
+static unsigned clk_failed;
+static struct spinlock clk_lock = SPINLOCK_INITIALIZER;
+static struct semaphore *clk_donesem;
+
+/*
+ * Nanoseconds since SECS/NSECS.
+ */
+static
+uint32_t
+clk_since(time_t secs, uint32_t nsecs)
+{
+	time_t nowsecs;
+	uint32_t nownsecs;
+
+	gettime(&nowsecs, &nownsecs);
+	getinterval(secs, nsecs, nowsecs, nownsecs, &secs, &nsecs);
+	return secs * 1000000000 + nsecs;
+}
+
+static
+void
+clkthread(void *junk, unsigned long num)
+{
+	time_t secs;
+	uint32_t nsecs, start, ticks, real;
+	unsigned cpunum;
+	bool failed;
+
+	(void)junk;
+
+	while (!clk_go) {
+		/* wait for everyone to be forked */
+	}
+
+	cpunum = curcpu->c_number;
+	if (cpunum == 0) {
+		/* leave cpu 0 alone so it goes idle */
+		V(clk_donesem);
+		return;
+	}
+
+	failed = false;
+
+	/* watch the tick count go by */
+	start = clock_ticks();
+	gettime(&secs, &nsecs);
+	while (clk_since(secs, nsecs) < CLK_SPINTICKS * CLK_NSPERTICK) {
+		/* spin */
+	}
+	ticks = clock_ticks() - start;
+	if (ticks + 1 < CLK_SPINTICKS) {
+		kprintf("clocktest %lu (cpu %u): %u ticks in %u\n",
+			num, cpunum, ticks, CLK_SPINTICKS);
+		failed = true;
+	}
+
+	/* and sleep */
+	gettime(&secs, &nsecs);
+	clocksleep_ticks(CLK_SLEEPTICKS);
+	real = clk_since(secs, nsecs);
+	if (real < (CLK_SLEEPTICKS - 1) * CLK_NSPERTICK) {
+		kprintf("clocktest %lu (cpu %u): slept %u ns for %u ticks\n",
+			num, cpunum, real, CLK_SLEEPTICKS);
+		failed = true;
+	}
+
+	spinlock_acquire(&clk_lock);
+	clk_ran++;
+	if (failed) {
+		clk_failed++;
+	}
+	spinlock_release(&clk_lock);
+
+	V(clk_donesem);
+}
+
+int
+clocktest(int nargs, char **args)
+{
+	unsigned nthreads, i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	nthreads = cpu_count();
+	if (nthreads < 2) {
+		kprintf("clocktest: needs more than one cpu\n");
+		return 0;
+	}
+	if (nthreads > CLK_MAXTHREADS) {
+		nthreads = CLK_MAXTHREADS;
+	}
+
+	if (clk_donesem == NULL) {
+		clk_donesem = sem_create("clk_donesem", 0);
+		if (clk_donesem == NULL) {
+			panic("clocktest: sem_create failed\n");
+		}
+	}
+
+	kprintf("Starting tickless clock test...\n");
+	clk_go = false;
+	clk_ran = 0;
+	clk_failed = 0;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("clocktest", clkthread, NULL, i, NULL);
+		if (result) {
+			panic("clocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	clk_go = true;
+	for (i=0; i<nthreads; i++) {
+		P(clk_donesem);
+	}
+
+	if (clk_ran == 0) {
+		kprintf("clocktest: no thread got off cpu 0; "
+			"try again\n");
+		return 0;
+	}
+	if (clk_failed > 0) {
+		kprintf("Test failed (%u of %u threads)\n",
+			clk_failed, clk_ran);
+		return 0;
+	}
+	kprintf("Tickless clock test done (%u threads).\n", clk_ran);
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Spinlock benchmark.
+ *
+ * For each number of threads from 1 up to the number of cpus (or the
+ * number given), has that many threads hammer one spinlock for a
+ * second, and reports the total number of acquisitions and how
+ * evenly they were spread across the threads. The threads aren't
+ * bound to cpus, but with no more threads than cpus and work
+ * stealing, they should end up one per cpu.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SPB_MAXTHREADS	32
+#define SPB_TICKS	HZ	/* length of each round */
+
+static struct spinlock spb_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned long spb_shared;
+static unsigned long spb_counts[SPB_MAXTHREADS];
+static volatile bool spb_go;
+static volatile bool spb_stop;
+static struct semaphore *spb_donesem;
+
+static
+void
+spbthread(void *junk, unsigned long num)
+{
+	unsigned long count;
+
+	(void)junk;
+
+	while (!spb_go) {
+		/* wait for everyone to be forked */
+	}
+
+	count = 0;
+	while (!spb_stop) {
+		spinlock_acquire(&spb_lock);
+		spb_shared++;
+		spinlock_release(&spb_lock);
+		count++;
+	}
+
+	spb_counts[num] = count;
+	V(spb_donesem);
+}
+
+static
+void
+spbround(unsigned nthreads)
+{
+	unsigned long total, min, max;
+	unsigned i;
+	int result;
+
+	spb_shared = 0;
+	spb_go = false;
+	spb_stop = false;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinlockbench", spbthread, NULL, i,
+				     NULL);
+		if (result) {
+			panic("spinlockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	spb_go = true;
+	clocksleep_ticks(SPB_TICKS);
+	spb_stop = true;
+
+	for (i=0; i<nthreads; i++) {
+		P(spb_donesem);
+	}
+
+	total = 0;
+	min = max = spb_counts[0];
+	for (i=0; i<nthreads; i++) {
+		total += spb_counts[i];
+		if (spb_counts[i] < min) {
+			min = spb_counts[i];
+		}
+		if (spb_counts[i] > max) {
+			max = spb_counts[i];
+		}
+	}
+
+	if (total != spb_shared) {
+		kprintf("%u threads: counted %lu acquires but the lock "
+			"protected %lu\n", nthreads, total, spb_shared);
+		kprintf("Test failed\n");
+		return;
+	}
+
+	/* min/max as a percentage: 100 is perfectly fair */
+	kprintf("%2u threads: %8lu acquires/sec, per thread "
+		"min %lu max %lu, fairness %lu%%\n",
+		nthreads, total * HZ / SPB_TICKS, min, max,
+		max > 0 ? min * 100 / max : 100);
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	unsigned maxthreads, n;
+
+	maxthreads = cpu_count();
+	if (nargs > 1) {
+		if (atoi(args[1]) < 1) {
+			kprintf("Usage: spb [maxthreads]\n");
+			return EINVAL;
+		}
+		maxthreads = atoi(args[1]);
+	}
+	if (maxthreads > SPB_MAXTHREADS) {
+		maxthreads = SPB_MAXTHREADS;
+	}
+
+	if (spb_donesem == NULL) {
+		spb_donesem = sem_create("spb_donesem", 0);
+		if (spb_donesem == NULL) {
+			panic("spinlockbench: sem_create failed\n");
+		}
+	}
+
+	kprintf("Starting spinlock benchmark (%u cpus)...\n", cpu_count());
+	for (n=1; n<=maxthreads; n++) {
+		spbround(n);
+	}
+	kprintf("Spinlock benchmark done.\n");
+
+	return 0;
+}
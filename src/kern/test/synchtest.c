@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
@@ -43,6 +44,10 @@
 #define NCVLOOPS      5
 #define NTHREADS      32
 
+#define NBENCHTHREADS 8
+#define NBENCHLOOPS   20000
+#define BENCHWORK     20
+
 static volatile unsigned long testval1;
 static volatile unsigned long testval2;
 static volatile unsigned long testval3;
@@ -51,6 +56,9 @@ static struct lock *testlock;
 static struct cv *testcv;
 static struct semaphore *donesem;
 
+static struct lock *benchlock;
+static volatile unsigned long benchcount;
+
 static
 void
 inititems(void)
@@ -220,6 +228,98 @@ locktest(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Lock contention benchmark: several threads take turns with one lock
+ * around a very short critical section, which is the case where
+ * spinning instead of sleeping pays off.
+ */
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	volatile unsigned long x;
+	int i, j;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NBENCHLOOPS; i++) {
+		lock_acquire(benchlock);
+		x = benchcount;
+		for (j=0; j<BENCHWORK; j++) {
+			x++;
+		}
+		benchcount = x - BENCHWORK + 1;
+		lock_release(benchlock);
+	}
+	V(donesem);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	time_t s1, s2;
+	uint32_t ns1, ns2;
+	unsigned long nthreads, i, msecs;
+	int result;
+
+	nthreads = NBENCHTHREADS;
+	if (nargs > 1) {
+		if (atoi(args[1]) < 1) {
+			kprintf("Usage: sy6 [nthreads]\n");
+			return EINVAL;
+		}
+		nthreads = atoi(args[1]);
+	}
+
+	inititems();
+	if (benchlock == NULL) {
+		benchlock = lock_create("benchlock");
+		if (benchlock == NULL) {
+			panic("lockbench: lock_create failed\n");
+		}
+	}
+	benchcount = 0;
+
+	kprintf("Starting lock benchmark: %lu threads, %d loops each...\n",
+		nthreads, NBENCHLOOPS);
+
+	gettime(&s1, &ns1);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("lockbench", lockbenchthread, NULL, i,
+				     NULL);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(donesem);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &s2, &ns2);
+
+	if (benchcount != nthreads * NBENCHLOOPS) {
+		kprintf("Count is %lu, should be %lu\n", benchcount,
+			nthreads * NBENCHLOOPS);
+		kprintf("Test failed\n");
+		return 0;
+	}
+
+	msecs = s2 * 1000 + ns2 / 1000000;
+	kprintf("%lu acquires in %llu.%09lu seconds",
+		benchcount, (unsigned long long)s2, (unsigned long)ns2);
+	if (msecs > 0) {
+		kprintf(" (%lu per second)",
+			benchcount / msecs * 1000 +
+			benchcount % msecs * 1000 / msecs);
+	}
+	kprintf("\n");
+	kprintf("Lock benchmark done.\n");
+
+	return 0;
+}
+
 static
 void
 cvtestthread(void *junk, unsigned long num)
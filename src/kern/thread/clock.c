@@ -30,17 +30,19 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Besides lbolt, which is woken once a second, there's a callout
+ * wheel so things can be scheduled to happen at a particular
+ * hardclock in the future.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -58,6 +60,77 @@
  */
 static struct wchan *lbolt;
 
+/*
+ * Callout wheel.
+ *
+ * This is a hierarchical timing wheel: CALLOUT_LEVELS wheels of
+ * CALLOUT_SLOTS slots each. A callout due within CALLOUT_SLOTS ticks
+ * goes in the bottom wheel, in the slot for its expiry tick; one due
+ * further out goes in a slot of a higher wheel that covers a range of
+ * ticks. Each time the bottom wheel wraps around, the next slot of the
+ * wheel above is emptied and its callouts are redistributed into the
+ * wheels below. So scheduling and canceling are O(1), and each tick
+ * only looks at callouts that are actually due (plus, occasionally, a
+ * cascade).
+ *
+ * Callouts further out than the top wheel covers (about 46 hours at
+ * HZ=100) are clamped to the furthest tick it can hold.
+ *
+ * The wheel is advanced by cpu 0 only; callout_now is the next tick to
+ * be processed.
+ */
+#define CALLOUT_BITS		6
+#define CALLOUT_SLOTS		(1U << CALLOUT_BITS)
+#define CALLOUT_MASK		(CALLOUT_SLOTS - 1)
+#define CALLOUT_LEVELS		4
+#define CALLOUT_MAXDELTA	((1U << (CALLOUT_BITS * CALLOUT_LEVELS)) - 1)
+
+static struct spinlock callout_lock = SPINLOCK_INITIALIZER;
+static struct callout *callout_wheel[CALLOUT_LEVELS][CALLOUT_SLOTS];
+static uint32_t callout_now;
+static struct callout *callout_running;	/* callout being called, if any */
+
+/*
+ * Tickless idle.
+ *
+ * An idle cpu has nothing to preempt, so it doesn't need a timer
+ * interrupt every tick. Before idling, its timer is stretched to go
+ * off when the next callout is due (if it's the cpu that runs
+ * callouts) or after IDLE_MAXTICKS; any other interrupt, including
+ * the IPI sent when a thread is made runnable for it, wakes it up
+ * sooner. Either way the ticks that went by are accounted for
+ * afterwards.
+ *
+ * While callout_cpu is idle, callout_idleuntil is the last tick it
+ * will process when it wakes; scheduling a callout due before that
+ * sends it an IPI so it can re-stretch its timer.
+ *
+ * callout_now doesn't move while callout_cpu is idle, for up to
+ * IDLE_MAXTICKS, so other cpus can't go by it: a callout or deadline
+ * computed from it would be measured from when callout_cpu went idle,
+ * and come due early once it catches up. Instead, callout_curtick
+ * works out the tick it's really on from the real-time clock, the
+ * same way clock_idle_exit will count the ticks it missed: from
+ * callout_idlesecs/nsecs, when the tick that was current as it went
+ * idle began, and callout_idlebase, the value callout_now had then.
+ * All of this is protected by callout_lock.
+ */
+#define IDLE_MAXTICKS		HZ
+#define NS_PER_TICK		(1000000000 / HZ)
+
+static struct cpu *callout_cpu;
+static bool callout_cpuidle;
+static uint32_t callout_idleuntil;
+static uint32_t callout_idlebase;
+static time_t callout_idlesecs;
+static uint32_t callout_idlensecs;
+
+/*
+ * Used by clocksleep_ticks. Nobody ever wakes this up; sleepers rely
+ * on the timeout.
+ */
+static struct wchan *ticksleep;
+
 /*
  * Setup.
  */
@@ -68,6 +141,284 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	ticksleep = wchan_create("ticksleep");
+	if (ticksleep == NULL) {
+		panic("Couldn't create ticksleep\n");
+	}
+	callout_cpu = curcpu->c_self;
+}
+
+/*
+ * Put a callout into the right wheel slot for its expiry time.
+ * Callout lock must be held.
+ */
+static
+void
+callout_insert(struct callout *co)
+{
+	uint32_t delta;
+	unsigned level, slot;
+
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+	KASSERT(co->co_pprev == NULL);
+
+	delta = co->co_expire - callout_now;
+	if (delta > CALLOUT_MAXDELTA) {
+		delta = CALLOUT_MAXDELTA;
+		co->co_expire = callout_now + delta;
+	}
+
+	for (level = 0; level < CALLOUT_LEVELS - 1; level++) {
+		if (delta < (1U << (CALLOUT_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	slot = (co->co_expire >> (CALLOUT_BITS * level)) & CALLOUT_MASK;
+
+	co->co_next = callout_wheel[level][slot];
+	if (co->co_next != NULL) {
+		co->co_next->co_pprev = &co->co_next;
+	}
+	co->co_pprev = &callout_wheel[level][slot];
+	callout_wheel[level][slot] = co;
+}
+
+/*
+ * Take a callout off whatever slot it's in. Callout lock must be held.
+ */
+static
+void
+callout_remove(struct callout *co)
+{
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+	KASSERT(co->co_pprev != NULL);
+
+	*co->co_pprev = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_pprev = co->co_pprev;
+	}
+	co->co_next = NULL;
+	co->co_pprev = NULL;
+}
+
+/*
+ * Empty a slot of one of the upper wheels, redistributing its
+ * callouts into the wheels below. Returns the slot number, so the
+ * caller knows whether this wheel has wrapped too.
+ */
+static
+unsigned
+callout_cascade(unsigned level)
+{
+	struct callout *co;
+	unsigned slot;
+
+	slot = (callout_now >> (CALLOUT_BITS * level)) & CALLOUT_MASK;
+	while ((co = callout_wheel[level][slot]) != NULL) {
+		callout_remove(co);
+		callout_insert(co);
+	}
+	return slot;
+}
+
+/*
+ * Process one tick of the callout wheel. Called from hardclock on
+ * cpu 0.
+ */
+static
+void
+callout_tick(void)
+{
+	struct callout *co;
+	unsigned slot, level;
+
+	spinlock_acquire(&callout_lock);
+
+	slot = callout_now & CALLOUT_MASK;
+	if (slot == 0) {
+		for (level = 1; level < CALLOUT_LEVELS; level++) {
+			if (callout_cascade(level) != 0) {
+				break;
+			}
+		}
+	}
+
+	/*
+	 * Everything in this slot is due now. Call the functions
+	 * without the lock held, so they can schedule or cancel
+	 * callouts (including themselves) and wake things up.
+	 */
+	while ((co = callout_wheel[0][slot]) != NULL) {
+		KASSERT(co->co_expire == callout_now);
+		callout_remove(co);
+		callout_running = co;
+		spinlock_release(&callout_lock);
+
+		co->co_func(co->co_arg);
+
+		spinlock_acquire(&callout_lock);
+		callout_running = NULL;
+	}
+
+	callout_now++;
+
+	spinlock_release(&callout_lock);
+}
+
+/*
+ * The tick the callout wheel is really on: callout_now, or if
+ * callout_cpu is tickless-idle, what callout_now will be once it
+ * catches up. It can't catch up past callout_idleuntil. Callout lock
+ * must be held.
+ */
+static
+uint32_t
+callout_curtick(void)
+{
+	time_t secs;
+	uint32_t nsecs, elapsed, now;
+
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+
+	if (!callout_cpuidle) {
+		return callout_now;
+	}
+
+	gettime(&secs, &nsecs);
+	getinterval(callout_idlesecs, callout_idlensecs, secs, nsecs,
+		    &secs, &nsecs);
+	elapsed = secs * HZ + nsecs / NS_PER_TICK;
+	if (elapsed > callout_idleuntil + 1 - callout_idlebase) {
+		elapsed = callout_idleuntil + 1 - callout_idlebase;
+	}
+	now = callout_idlebase + elapsed;
+
+	/* while it's catching up, callout_now may already be ahead */
+	if ((int32_t)(callout_now - now) > 0) {
+		now = callout_now;
+	}
+	return now;
+}
+
+void
+callout_init(struct callout *co)
+{
+	co->co_next = NULL;
+	co->co_pprev = NULL;
+	co->co_expire = 0;
+	co->co_func = NULL;
+	co->co_arg = NULL;
+}
+
+void
+callout_schedule(struct callout *co, unsigned ticks,
+		 void (*func)(void *), void *arg)
+{
+	bool kick;
+
+	spinlock_acquire(&callout_lock);
+	if (co->co_pprev != NULL) {
+		callout_remove(co);
+	}
+	co->co_func = func;
+	co->co_arg = arg;
+	co->co_expire = callout_curtick() + ticks;
+	callout_insert(co);
+	kick = callout_cpuidle && callout_cpu != curcpu->c_self &&
+		(int32_t)(co->co_expire - callout_idleuntil) < 0;
+	spinlock_release(&callout_lock);
+
+	if (kick) {
+		ipi_send(callout_cpu, IPI_UNIDLE);
+	}
+}
+
+bool
+callout_cancel(struct callout *co)
+{
+	bool ret;
+
+	spinlock_acquire(&callout_lock);
+	if (co->co_pprev != NULL) {
+		callout_remove(co);
+		ret = true;
+	}
+	else {
+		ret = false;
+		/*
+		 * If it's running on cpu 0 right now, wait for it.
+		 * It can't be running on *this* cpu: callouts run in
+		 * the timer interrupt, which finishes before we get
+		 * the cpu back.
+		 */
+		while (callout_running == co) {
+			spinlock_release(&callout_lock);
+			spinlock_acquire(&callout_lock);
+		}
+	}
+	spinlock_release(&callout_lock);
+
+	return ret;
+}
+
+bool
+callout_pending(struct callout *co)
+{
+	bool ret;
+
+	spinlock_acquire(&callout_lock);
+	ret = (co->co_pprev != NULL);
+	spinlock_release(&callout_lock);
+
+	return ret;
+}
+
+/*
+ * Return how many ticks callout_cpu can go without a timer interrupt,
+ * up to MAX: until the next tick with a callout due, or the next
+ * tick where the bottom wheel wraps and the upper wheels cascade, if
+ * they have anything in them. Callout lock must be held.
+ */
+static
+unsigned
+callout_idleticks(unsigned max)
+{
+	unsigned i, level, slot;
+	bool upper;
+
+	KASSERT(spinlock_do_i_hold(&callout_lock));
+
+	upper = false;
+	for (level = 1; level < CALLOUT_LEVELS && !upper; level++) {
+		for (slot = 0; slot < CALLOUT_SLOTS; slot++) {
+			if (callout_wheel[level][slot] != NULL) {
+				upper = true;
+				break;
+			}
+		}
+	}
+
+	/* Everything in the bottom wheel is due within CALLOUT_SLOTS. */
+	for (i = 0; i < max && i < CALLOUT_SLOTS; i++) {
+		slot = (callout_now + i) & CALLOUT_MASK;
+		if (callout_wheel[0][slot] != NULL || (upper && slot == 0)) {
+			/* tick callout_now + i is processed i+1 ticks out */
+			return i + 1;
+		}
+	}
+	return max;
+}
+
+uint32_t
+clock_ticks(void)
+{
+	uint32_t now;
+
+	spinlock_acquire(&callout_lock);
+	now = callout_curtick();
+	spinlock_release(&callout_lock);
+
+	return now;
 }
 
 /*
@@ -81,9 +432,93 @@ timerclock(void)
 	wchan_wakeall(lbolt);
 }
 
+/*
+ * Account for ticks the current cpu skipped while tickless.
+ */
+static
+void
+hardclock_catchup(unsigned ticks)
+{
+	curcpu->c_hardclocks += ticks;
+	if (curcpu->c_self == callout_cpu) {
+		while (ticks-- > 0) {
+			callout_tick();
+		}
+	}
+}
+
+void
+clock_idle_enter(void)
+{
+	unsigned ticks;
+	uint32_t phase;
+
+	KASSERT(curcpu->c_tickless == 0);
+
+	ticks = IDLE_MAXTICKS;
+	if (curcpu->c_self != callout_cpu) {
+		if (ticks > 1) {
+			curcpu->c_tickless = ticks;
+			mainbus_timer_stretch(ticks);
+		}
+		return;
+	}
+
+	/*
+	 * Stretch the timer and note the time under the lock, so
+	 * nobody sees callout_cpuidle without the idle start time.
+	 */
+	spinlock_acquire(&callout_lock);
+	ticks = callout_idleticks(ticks);
+	if (ticks > 1) {
+		curcpu->c_tickless = ticks;
+		phase = mainbus_timer_stretch(ticks);
+		gettime(&callout_idlesecs, &callout_idlensecs);
+		/* back up to the start of the current tick */
+		if (callout_idlensecs < phase) {
+			callout_idlensecs += 1000000000;
+			callout_idlesecs--;
+		}
+		callout_idlensecs -= phase;
+		callout_idlebase = callout_now;
+		callout_idleuntil = callout_now + ticks - 1;
+		callout_cpuidle = true;
+	}
+	spinlock_release(&callout_lock);
+}
+
+void
+clock_idle_exit(void)
+{
+	unsigned ticks;
+
+	/*
+	 * If the stretched timer went off, hardclock already caught
+	 * up; otherwise we were woken early by some other interrupt.
+	 */
+	if (curcpu->c_tickless > 0) {
+		ticks = mainbus_timer_unstretch();
+		if (ticks > curcpu->c_tickless) {
+			ticks = curcpu->c_tickless;
+		}
+		curcpu->c_tickless = 0;
+		hardclock_catchup(ticks);
+	}
+
+	/*
+	 * Only now that callout_now is caught up can other cpus go
+	 * by it again.
+	 */
+	if (curcpu->c_self == callout_cpu) {
+		spinlock_acquire(&callout_lock);
+		callout_cpuidle = false;
+		spinlock_release(&callout_lock);
+	}
+}
+
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, except on idle processors, which skip ticks.
  */
 void
 hardclock(void)
@@ -92,14 +527,28 @@ hardclock(void)
 	 * Collect statistics here as desired.
 	 */
 
+	if (curcpu->c_tickless > 0) {
+		/*
+		 * The stretched idle timer went off. This interrupt
+		 * stands for the last of the ticks it covered.
+		 */
+		hardclock_catchup(curcpu->c_tickless - 1);
+		curcpu->c_tickless = 0;
+	}
+
 	curcpu->c_hardclocks++;
+	if (curcpu->c_self == callout_cpu) {
+		callout_tick();
+	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	if (thread_preempt_due()) {
+		thread_yield();
+	}
 }
 
 /*
@@ -108,9 +557,27 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	while (num_secs > 0) {
-		wchan_lock(lbolt);
-		wchan_sleep(lbolt);
-		num_secs--;
+	if (num_secs > 0) {
+		clocksleep_ticks(num_secs * HZ);
+	}
+}
+
+/*
+ * Suspend execution for n hardclocks.
+ */
+void
+clocksleep_ticks(unsigned ticks)
+{
+	uint32_t deadline, now;
+
+	deadline = clock_ticks() + ticks;
+	while (1) {
+		now = clock_ticks();
+		/* careful of wraparound */
+		if ((int32_t)(deadline - now) <= 0) {
+			break;
+		}
+		wchan_lock(ticksleep);
+		wchan_sleep_timeout(ticksleep, deadline - now);
 	}
 }
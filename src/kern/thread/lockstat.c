@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <mainbus.h>
+#include <lockstat.h>
+
+/* Most locks lockstat_print will show */
+#define LOCKSTAT_MAXTOP	16
+
+/*
+ * The registry. It can't be protected by a spinlock, because that
+ * spinlock would have stats and need registering; so use the
+ * machine-level lock word directly.
+ */
+static volatile spinlock_data_t lockstat_reglock = SPINLOCK_DATA_INITIALIZER;
+static struct lockstat *lockstat_list;
+
+static const char *const lockstat_kinds[] = { "spin", "lock", "cv" };
+
+static
+int
+lockstat_lockreg(void)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_testandset(&lockstat_reglock) != 0) {
+		/* spin */
+	}
+	return spl;
+}
+
+static
+void
+lockstat_unlockreg(int spl)
+{
+	spinlock_data_set(&lockstat_reglock, 0);
+	splx(spl);
+}
+
+void
+lockstat_init(struct lockstat *ls, unsigned kind, const char *name)
+{
+	KASSERT(kind == LOCKSTAT_SPINLOCK || kind == LOCKSTAT_LOCK ||
+		kind == LOCKSTAT_CV);
+
+	ls->ls_next = NULL;
+	ls->ls_prevp = NULL;
+	ls->ls_name = name;
+	ls->ls_where = NULL;
+	ls->ls_kind = kind;
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waitcycles = 0;
+	ls->ls_holdstart = 0;
+	ls->ls_maxhold = 0;
+}
+
+void
+lockstat_cleanup(struct lockstat *ls)
+{
+	int spl;
+
+	spl = lockstat_lockreg();
+	if (ls->ls_prevp != NULL) {
+		*ls->ls_prevp = ls->ls_next;
+		if (ls->ls_next != NULL) {
+			ls->ls_next->ls_prevp = ls->ls_prevp;
+		}
+		ls->ls_next = NULL;
+		ls->ls_prevp = NULL;
+	}
+	lockstat_unlockreg(spl);
+}
+
+uint64_t
+lockstat_now(void)
+{
+	uint64_t now;
+	int spl;
+
+	spl = splhigh();
+	now = mainbus_cycles();
+	splx(spl);
+
+	return now;
+}
+
+void
+lockstat_acquired(struct lockstat *ls, bool contended, uint64_t start,
+		  const void *where)
+{
+	uint64_t now;
+	int spl;
+
+	if (ls->ls_prevp == NULL) {
+		/* first use; join the registry */
+		spl = lockstat_lockreg();
+		ls->ls_where = where;
+		ls->ls_next = lockstat_list;
+		if (ls->ls_next != NULL) {
+			ls->ls_next->ls_prevp = &ls->ls_next;
+		}
+		ls->ls_prevp = &lockstat_list;
+		lockstat_list = ls;
+		lockstat_unlockreg(spl);
+	}
+
+	now = lockstat_now();
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+		/* counters on different cpus can disagree */
+		if (now > start) {
+			ls->ls_waitcycles += now - start;
+		}
+	}
+	ls->ls_holdstart = now;
+}
+
+void
+lockstat_released(struct lockstat *ls)
+{
+	uint64_t now;
+
+	if (ls->ls_prevp == NULL) {
+		/* the acquire wasn't recorded (too early in boot) */
+		return;
+	}
+
+	now = lockstat_now();
+	if (now > ls->ls_holdstart && now - ls->ls_holdstart > ls->ls_maxhold) {
+		ls->ls_maxhold = now - ls->ls_holdstart;
+	}
+}
+
+/*
+ * Print the N locks with the most contended acquisitions. The stats
+ * are copied out under the registry lock and printed afterwards.
+ */
+void
+lockstat_print(unsigned n)
+{
+	struct lockstat top[LOCKSTAT_MAXTOP];
+	struct lockstat *ls;
+	unsigned i, j, ntop, nlocks;
+	int spl;
+
+	if (n > LOCKSTAT_MAXTOP) {
+		n = LOCKSTAT_MAXTOP;
+	}
+
+	ntop = 0;
+	nlocks = 0;
+	spl = lockstat_lockreg();
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		nlocks++;
+		/* insertion sort into top[], most contended first */
+		for (i = ntop; i > 0; i--) {
+			if (top[i-1].ls_contended >= ls->ls_contended) {
+				break;
+			}
+		}
+		if (i >= n) {
+			continue;
+		}
+		if (ntop < n) {
+			ntop++;
+		}
+		for (j = ntop - 1; j > i; j--) {
+			top[j] = top[j-1];
+		}
+		top[i] = *ls;
+	}
+	lockstat_unlockreg(spl);
+
+	kprintf("%u locks in use; %u most contended:\n", nlocks, ntop);
+	kprintf("kind   contended    acquires   wait cycles    max hold  "
+		"lock\n");
+	for (i = 0; i < ntop; i++) {
+		kprintf("%-4s %11llu %11llu %13llu %11llu  ",
+			lockstat_kinds[top[i].ls_kind],
+			(unsigned long long)top[i].ls_contended,
+			(unsigned long long)top[i].ls_acquires,
+			(unsigned long long)top[i].ls_waitcycles,
+			(unsigned long long)top[i].ls_maxhold);
+		if (top[i].ls_name != NULL) {
+			kprintf("%s\n", top[i].ls_name);
+		}
+		else {
+			kprintf("(first taken at %p)\n", top[i].ls_where);
+		}
+	}
+}
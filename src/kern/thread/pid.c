@@ -8,7 +8,6 @@
 #include <limits.h>
 #include <kern/unistd.h>
 #include <lib.h>
-#include <array.h>
 #include <clock.h>
 #include <thread.h>
 #include <synch.h>
@@ -19,31 +18,63 @@
 /*
  * Structure for holding exit data of a thread.
  *
- * If pi_ppid is INVALID_PID, the parent has gone away and will not be
- * waiting. If pi_ppid is INVALID_PID and pi_exited is true, the
- * structure can be freed.
+ * A process with a living parent is on one of the parent's two
+ * lists: pi_children while it runs, then pi_zombies once it has
+ * exited and until the parent reaps it. The lists are linked through
+ * pi_sibling/pi_siblingp. The parent's pi_lock protects both lists
+ * and, for each process on them, pi_parent, pi_exited and
+ * pi_exitstatus. The parent sleeps on its own pi_cv until one of its
+ * children exits, so waiting for any child is a single wait.
+ *
+ * If pi_parent is NULL, the parent has gone away and will not be
+ * waiting. If pi_parent is NULL and pi_exited is true, the structure
+ * can be freed.
+ *
+ * When both are needed, pidlock is taken before any pi_lock and a
+ * parent's pi_lock before a child's. pidlock is never taken while
+ * holding a pi_lock.
  */
 struct pidinfo {
 	int pi_pid;			// process id of this thread
-	int pi_ppid;			// process id of parent thread
+	struct lock *pi_lock;		// lock for our lists
+	struct cv *pi_cv;		// use to wait for a child to exit
+	struct pidinfo *pi_parent;	// our parent, if any
 	volatile int pi_exited;		// true if thread has exited
 	int pi_exitstatus;		// status (only valid if exited)
-	struct cv *pi_cv;		// use to wait for thread exit
+	struct pidinfo *pi_children;	// our children still running
+	struct pidinfo *pi_zombies;	// our children exited, not reaped
+	struct pidinfo *pi_sibling;	// next on our parent's list
+	struct pidinfo **pi_siblingp;	// link pointing to us
 };
 
 
 /*
  * Global pid and exit data.
  *
- * The process table is an el-cheapo hash table. It's indexed by
- * (pid % PROCS_MAX), and only allows one process per slot. If a
- * new pid allocation would cause a hash collision, we just don't
- * use that pid.
+ * The process table is indexed directly by pid. It starts with
+ * PIDTABLE_MINSIZE slots and doubles whenever it gets 3/4 full, up
+ * to PID_MAX+1 slots; pids are only handed out below the current
+ * size. pidmap has one bit per slot, set if the pid is in use, so a
+ * free pid is found a word at a time. The search starts from just
+ * after the last pid handed out, so pids aren't reused right away.
+ *
+ * pidlock is a reader-writer lock protecting the table itself.
+ * Looking a pid up only needs it for reading; adding, removing, or
+ * growing needs it for writing. Everything else about a process is
+ * protected by its own pi_lock, so exiting and waiting don't
+ * touch pidlock except to free the pidinfo at the end.
  */
-static struct lock *pidlock;		// lock for global exit data
-static struct pidinfo *pidinfo[PROCS_MAX]; // actual pid info
-static pid_t nextpid;			// next candidate pid
-static int nprocs;			// number of allocated pids
+#define PIDTABLE_MINSIZE	128
+#define PIDTABLE_MAXSIZE	(PID_MAX+1)
+
+static struct rwlock *pidlock;		// lock for the table
+static struct pidinfo **pidtable;	// actual pid info
+static uint32_t *pidmap;		// bit set if pid in use
+static unsigned pidtable_size;		// slots in pidtable
+static pid_t nextpid;			// where to start looking
+static unsigned nprocs;			// number of allocated pids
+
+#define PIDMAP_WORDS(size)	((size) / 32)
 
 
 
@@ -52,7 +83,7 @@ static int nprocs;			// number of allocated pids
  */
 static
 struct pidinfo *
-pidinfo_create(pid_t pid, pid_t ppid)
+pidinfo_create(pid_t pid)
 {
 	struct pidinfo *pi;
 
@@ -63,16 +94,27 @@ pidinfo_create(pid_t pid, pid_t ppid)
 		return NULL;
 	}
 
-	pi->pi_cv = cv_create("pidinfo cv");
+	pi->pi_lock = lock_create("pidinfo");
+	if (pi->pi_lock == NULL) {
+		kfree(pi);
+		return NULL;
+	}
+
+	pi->pi_cv = cv_create("pidinfo");
 	if (pi->pi_cv == NULL) {
+		lock_destroy(pi->pi_lock);
 		kfree(pi);
 		return NULL;
 	}
 
 	pi->pi_pid = pid;
-	pi->pi_ppid = ppid;
+	pi->pi_parent = NULL;
 	pi->pi_exited = 0;
 	pi->pi_exitstatus = 0xbeef;  /* Recognizably invalid value */
+	pi->pi_children = NULL;
+	pi->pi_zombies = NULL;
+	pi->pi_sibling = NULL;
+	pi->pi_siblingp = NULL;
 
 	return pi;
 }
@@ -85,33 +127,134 @@ void
 pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited==1);
-	KASSERT(pi->pi_ppid==INVALID_PID);
+	KASSERT(pi->pi_parent==NULL);
+	KASSERT(pi->pi_children==NULL);
+	KASSERT(pi->pi_zombies==NULL);
+	KASSERT(pi->pi_siblingp==NULL);
 	cv_destroy(pi->pi_cv);
+	lock_destroy(pi->pi_lock);
 	kfree(pi);
 }
 
+/*
+ * Put PI on the list at HEAD (one of its parent's lists). The
+ * parent's pi_lock must be held.
+ */
+static
+void
+pi_link(struct pidinfo **head, struct pidinfo *pi)
+{
+	KASSERT(pi->pi_siblingp == NULL);
+
+	pi->pi_sibling = *head;
+	if (pi->pi_sibling != NULL) {
+		pi->pi_sibling->pi_siblingp = &pi->pi_sibling;
+	}
+	pi->pi_siblingp = head;
+	*head = pi;
+}
+
+/*
+ * Take PI off whichever of its parent's lists it's on. The parent's
+ * pi_lock must be held.
+ */
+static
+void
+pi_unlink(struct pidinfo *pi)
+{
+	KASSERT(pi->pi_siblingp != NULL);
+
+	*pi->pi_siblingp = pi->pi_sibling;
+	if (pi->pi_sibling != NULL) {
+		pi->pi_sibling->pi_siblingp = pi->pi_siblingp;
+	}
+	pi->pi_sibling = NULL;
+	pi->pi_siblingp = NULL;
+}
+
 ////////////////////////////////////////////////////////////
 
+/*
+ * Allocate a table and bitmap of SIZE slots.
+ */
+static
+int
+pidtable_alloc(unsigned size, struct pidinfo ***table, uint32_t **map)
+{
+	unsigned i;
+
+	*table = kmalloc(size * sizeof(struct pidinfo *));
+	if (*table == NULL) {
+		return ENOMEM;
+	}
+	*map = kmalloc(PIDMAP_WORDS(size) * sizeof(uint32_t));
+	if (*map == NULL) {
+		kfree(*table);
+		return ENOMEM;
+	}
+	for (i=0; i<size; i++) {
+		(*table)[i] = NULL;
+	}
+	for (i=0; i<PIDMAP_WORDS(size); i++) {
+		(*map)[i] = 0;
+	}
+	return 0;
+}
+
+/*
+ * Double the size of the table. pidlock must be held for writing.
+ * Failure isn't fatal; we just keep using the table we have.
+ */
+static
+void
+pidtable_grow(void)
+{
+	struct pidinfo **newtable;
+	uint32_t *newmap;
+	unsigned newsize, i;
+
+	KASSERT(pidtable_size < PIDTABLE_MAXSIZE);
+	newsize = pidtable_size * 2;
+
+	if (pidtable_alloc(newsize, &newtable, &newmap)) {
+		return;
+	}
+	for (i=0; i<pidtable_size; i++) {
+		newtable[i] = pidtable[i];
+	}
+	for (i=0; i<PIDMAP_WORDS(pidtable_size); i++) {
+		newmap[i] = pidmap[i];
+	}
+
+	kfree(pidtable);
+	kfree(pidmap);
+	pidtable = newtable;
+	pidmap = newmap;
+	pidtable_size = newsize;
+}
+
 /*
  * pid_bootstrap: initialize.
  */
 void
 pid_bootstrap(void)
 {
-	int i;
-
-	pidlock = lock_create("pidlock");
+	pidlock = rwlock_create("pidlock");
 	if (pidlock == NULL) {
 		panic("Out of memory creating pid lock\n");
 	}
 
-	/* not really necessary - should start zeroed */
-	for (i=0; i<PROCS_MAX; i++) {
-		pidinfo[i] = NULL;
+	pidtable_size = PIDTABLE_MINSIZE;
+	if (pidtable_alloc(pidtable_size, &pidtable, &pidmap)) {
+		panic("Out of memory creating pid table\n");
 	}
 
-	pidinfo[BOOTUP_PID] = pidinfo_create(BOOTUP_PID, INVALID_PID);
-	if (pidinfo[BOOTUP_PID]==NULL) {
+	/* Pids below PID_MIN are never handed out. */
+	KASSERT(PID_MIN < 32);
+	pidmap[0] = (1U << PID_MIN) - 1;
+
+	pidtable[BOOTUP_PID] = pidinfo_create(BOOTUP_PID);
+	if (pidtable[BOOTUP_PID]==NULL) {
 		panic("Out of memory creating bootup pid data\n");
 	}
 
@@ -120,7 +263,8 @@ pid_bootstrap(void)
 }
 
 /*
- * pi_get: look up a pidinfo in the process table.
+ * pi_get: look up a pidinfo in the process table. pidlock must be
+ * held, for reading at least.
  */
 static
 struct pidinfo *
@@ -130,72 +274,118 @@ pi_get(pid_t pid)
 
 	KASSERT(pid>=0);
 	KASSERT(pid != INVALID_PID);
-	KASSERT(lock_do_i_hold(pidlock));
 
-	pi = pidinfo[pid % PROCS_MAX];
-	if (pi==NULL) {
+	if ((unsigned)pid >= pidtable_size) {
 		return NULL;
 	}
-	if (pi->pi_pid != pid) {
+	pi = pidtable[pid];
+	if (pi==NULL) {
 		return NULL;
 	}
+	KASSERT(pi->pi_pid == pid);
 	return pi;
 }
 
 /*
  * pi_put: insert a new pidinfo in the process table. The right slot
- * must be empty.
+ * must be empty, and already marked in use in pidmap.
  */
 static
 void
 pi_put(pid_t pid, struct pidinfo *pi)
 {
-	KASSERT(lock_do_i_hold(pidlock));
-
 	KASSERT(pid != INVALID_PID);
+	KASSERT((unsigned)pid < pidtable_size);
+	KASSERT(pidtable[pid] == NULL);
+	KASSERT(pidmap[pid / 32] & (1U << (pid % 32)));
 
-	KASSERT(pidinfo[pid % PROCS_MAX] == NULL);
-	pidinfo[pid % PROCS_MAX] = pi;
+	pidtable[pid] = pi;
 	nprocs++;
 }
 
 /*
  * pi_drop: remove a pidinfo structure from the process table and free
  * it. It should reflect a process that has already exited and been
- * waited for.
+ * waited for (or that nobody will wait for). Takes pidlock.
  */
 static
 void
-pi_drop(pid_t pid)
+pi_drop(struct pidinfo *pi)
 {
-	struct pidinfo *pi;
+	pid_t pid = pi->pi_pid;
 
-	KASSERT(lock_do_i_hold(pidlock));
-
-	pi = pidinfo[pid % PROCS_MAX];
-	KASSERT(pi != NULL);
-	KASSERT(pi->pi_pid == pid);
+	rwlock_acquire_write(pidlock);
+	KASSERT(pi_get(pid) == pi);
+	pidtable[pid] = NULL;
+	pidmap[pid / 32] &= ~(1U << (pid % 32));
+	nprocs--;
+	rwlock_release_write(pidlock);
 
 	pidinfo_destroy(pi);
-	pidinfo[pid % PROCS_MAX] = NULL;
-	nprocs--;
+}
+
+/*
+ * Get the current thread's pidinfo. It can't go away while we're
+ * running, so no lock is needed once we have it.
+ */
+static
+struct pidinfo *
+pi_self(void)
+{
+	struct pidinfo *us;
+
+	rwlock_acquire_read(pidlock);
+	us = pi_get(curthread->t_pid);
+	rwlock_release_read(pidlock);
+	KASSERT(us != NULL);
+	return us;
 }
 
 ////////////////////////////////////////////////////////////
 
 /*
- * Helper function for pid_alloc.
+ * Find a free pid and mark it in use. pidlock must be held for
+ * writing. Returns INVALID_PID if there are none.
+ *
+ * Scans from nextpid a word of pidmap at a time, skipping full words,
+ * so this is quick unless the table is nearly full - and the table
+ * grows before it gets that way.
  */
 static
-void
-inc_nextpid(void)
+pid_t
+pidmap_alloc(void)
 {
-	KASSERT(lock_do_i_hold(pidlock));
+	unsigned words, w, start, i, bit;
+	uint32_t m;
+	pid_t pid;
 
-	nextpid++;
-	if (nextpid > PID_MAX) {
+	words = PIDMAP_WORDS(pidtable_size);
+	if ((unsigned)nextpid >= pidtable_size) {
 		nextpid = PID_MIN;
 	}
+	start = nextpid / 32;
+
+	/* one extra pass to cover the low bits of the starting word */
+	for (i=0; i<=words; i++) {
+		w = (start + i) % words;
+		m = pidmap[w];
+		if (i == 0) {
+			/* pretend the pids below nextpid are taken */
+			m |= (1U << (nextpid % 32)) - 1;
+		}
+		if (m == 0xffffffff) {
+			continue;
+		}
+		for (bit = 0; m & (1U << bit); bit++) {
+			/* nothing */
+		}
+		pid = w * 32 + bit;
+		KASSERT(pid >= PID_MIN);
+		pidmap[w] |= 1U << bit;
+		nextpid = pid + 1;
+		return pid;
+	}
+	return INVALID_PID;
 }
 
 /*
@@ -204,79 +394,90 @@ inc_nextpid(void)
 int
 pid_alloc(pid_t *retval)
 {
-	struct pidinfo *pi;
+	struct pidinfo *pi, *us;
 	pid_t pid;
-	int count;
 
 	KASSERT(curthread->t_pid != INVALID_PID);
 
+	us = pi_self();
+
 	/* lock the table */
-	lock_acquire(pidlock);
+	rwlock_acquire_write(pidlock);
 
-	if (nprocs == PROCS_MAX) {
-		lock_release(pidlock);
-		return EAGAIN;
+	if (nprocs >= pidtable_size / 4 * 3 &&
+	    pidtable_size < PIDTABLE_MAXSIZE) {
+		pidtable_grow();
 	}
 
-	/*
-	 * The above test guarantees that this loop terminates, unless
-	 * our nprocs count is off. Even so, KASSERT we aren't looping
-	 * forever.
-	 */
-	count = 0;
-	while (pidinfo[nextpid % PROCS_MAX] != NULL) {
-
-		/* avoid various boundary cases by allowing extra loops */
-		KASSERT(count < PROCS_MAX*2+5);
-		count++;
-
-		inc_nextpid();
+	pid = pidmap_alloc();
+	if (pid == INVALID_PID) {
+		rwlock_release_write(pidlock);
+		return EAGAIN;
 	}
 
-	pid = nextpid;
-
-	pi = pidinfo_create(pid, curthread->t_pid);
+	pi = pidinfo_create(pid);
 	if (pi==NULL) {
-		lock_release(pidlock);
+		pidmap[pid / 32] &= ~(1U << (pid % 32));
+		rwlock_release_write(pidlock);
 		return ENOMEM;
 	}
 
 	pi_put(pid, pi);
 
-	inc_nextpid();
+	rwlock_release_write(pidlock);
 
-	lock_release(pidlock);
+	lock_acquire(us->pi_lock);
+	pi->pi_parent = us;
+	pi_link(&us->pi_children, pi);
+	lock_release(us->pi_lock);
 
 	*retval = pid;
 	return 0;
 }
 
 /*
- * pid_unalloc - unallocate a process id (allocated with pid_alloc) that
- * hasn't run yet.
+ * Look up one of our own children. It can't go away behind our back:
+ * only we free our children.
  */
-void
-pid_unalloc(pid_t theirpid)
+static
+struct pidinfo *
+pi_getchild(pid_t theirpid)
 {
 	struct pidinfo *them;
 
 	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
 
-	lock_acquire(pidlock);
-
+	rwlock_acquire_read(pidlock);
 	them = pi_get(theirpid);
+	rwlock_release_read(pidlock);
 	KASSERT(them != NULL);
+	return them;
+}
+
+/*
+ * pid_unalloc - unallocate a process id (allocated with pid_alloc) that
+ * hasn't run yet.
+ */
+void
+pid_unalloc(pid_t theirpid)
+{
+	struct pidinfo *us, *them;
+
+	us = pi_self();
+	them = pi_getchild(theirpid);
+
+	lock_acquire(us->pi_lock);
+	KASSERT(them->pi_parent == us);
 	KASSERT(them->pi_exited==0);
-	KASSERT(them->pi_ppid==curthread->t_pid);
+	pi_unlink(them);
+	them->pi_parent = NULL;
+	lock_release(us->pi_lock);
 
 	/* keep pidinfo_destroy from complaining */
 	them->pi_exitstatus = 0xdead;
 	them->pi_exited = 1;
-	them->pi_ppid = INVALID_PID;
-
-	pi_drop(theirpid);
 
-	lock_release(pidlock);
+	pi_drop(them);
 }
 
 /*
@@ -286,68 +487,123 @@ pid_unalloc(pid_t theirpid)
 void
 pid_disown(pid_t theirpid)
 {
-	struct pidinfo *them;
-
-	KASSERT(theirpid >= PID_MIN && theirpid <= PID_MAX);
-
-	lock_acquire(pidlock);
-
-	them = pi_get(theirpid);
-	KASSERT(them != NULL);
-	KASSERT(them->pi_ppid==curthread->t_pid);
-
-	them->pi_ppid = INVALID_PID;
-	if (them->pi_exited) {
-		pi_drop(them->pi_pid);
+	struct pidinfo *us, *them;
+	bool exited;
+
+	us = pi_self();
+	them = pi_getchild(theirpid);
+
+	lock_acquire(us->pi_lock);
+	KASSERT(them->pi_parent == us);
+	pi_unlink(them);
+	them->pi_parent = NULL;
+	exited = them->pi_exited;
+	lock_release(us->pi_lock);
+
+	/* if it's already gone, nobody else will free it */
+	if (exited) {
+		pi_drop(them);
 	}
-
-	lock_release(pidlock);
 }
 
 /*
  * pid_setexitstatus: Sets the exit status of this thread. Must only
- * be called if the thread actually had a pid assigned. Wakes up any
- * waiters and disposes of the piddata if nobody else is still using it.
+ * be called if the thread actually had a pid assigned. Wakes up our
+ * parent if it's waiting, and disposes of the piddata if nobody else
+ * is still interested in it.
  */
 void
 pid_setexitstatus(int status)
 {
-	struct pidinfo *us;
-	int i;
+	struct pidinfo *us, *parent, *child, *dead;
 
 	KASSERT(curthread->t_pid != INVALID_PID);
 
-	lock_acquire(pidlock);
+	us = pi_self();
 
-	/* First, disown all children */
-	for (i=0; i<PROCS_MAX; i++) {
-		if (pidinfo[i]==NULL) {
-			continue;
+	/*
+	 * First, disown all children. Running ones will free
+	 * themselves when they exit; free the zombies here, once
+	 * we've let go of our lock.
+	 */
+	lock_acquire(us->pi_lock);
+	while (us->pi_children != NULL) {
+		child = us->pi_children;
+		pi_unlink(child);
+		child->pi_parent = NULL;
+	}
+	dead = us->pi_zombies;
+	us->pi_zombies = NULL;
+	for (child = dead; child != NULL; child = child->pi_sibling) {
+		child->pi_siblingp = NULL;
+		child->pi_parent = NULL;
+	}
+	lock_release(us->pi_lock);
+
+	while (dead != NULL) {
+		child = dead;
+		dead = child->pi_sibling;
+		child->pi_sibling = NULL;
+		pi_drop(child);
+	}
+
+	/*
+	 * Now, move ourselves to our parent's zombie list and wake it
+	 * up. Holding pidlock keeps the parent from being freed while
+	 * we get at its lock; once we have that, check it hasn't
+	 * disowned us in the meantime.
+	 */
+	rwlock_acquire_read(pidlock);
+	parent = us->pi_parent;
+	if (parent != NULL) {
+		lock_acquire(parent->pi_lock);
+		if (us->pi_parent == parent) {
+			us->pi_exitstatus = status;
+			us->pi_exited = 1;
+			pi_unlink(us);
+			pi_link(&parent->pi_zombies, us);
+			cv_signal(parent->pi_cv, parent->pi_lock);
+			lock_release(parent->pi_lock);
 		}
-		if (pidinfo[i]->pi_ppid == curthread->t_pid) {
-			pidinfo[i]->pi_ppid = INVALID_PID;
-			if (pidinfo[i]->pi_exited) {
-				pi_drop(pidinfo[i]->pi_pid);
-			}
+		else {
+			lock_release(parent->pi_lock);
+			parent = NULL;
 		}
 	}
+	rwlock_release_read(pidlock);
 
-	/* Now, wake up our parent */
-	us = pi_get(curthread->t_pid);
-	KASSERT(us != NULL);
+	if (parent == NULL) {
+		/* no parent */
+		us->pi_exitstatus = status;
+		us->pi_exited = 1;
+		pi_drop(us);
+	}
+}
 
-	us->pi_exitstatus = status;
-	us->pi_exited = 1;
+/*
+ * Reap ZOMBIE, one of our zombie children. Our pi_lock must be
+ * held; it's released.
+ */
+static
+void
+pi_reap(struct pidinfo *us, struct pidinfo *zombie, int *status,
+	pid_t *ret)
+{
+	KASSERT(zombie->pi_parent == us);
+	KASSERT(zombie->pi_exited);
 
-	if (us->pi_ppid == INVALID_PID) {
-		/* no parent */
-		pi_drop(curthread->t_pid);
+	if (status != NULL) {
+		*status = zombie->pi_exitstatus;
 	}
-	else {
-		cv_broadcast(us->pi_cv, pidlock);
+	if (ret != NULL) {
+		*ret = zombie->pi_pid;
 	}
 
-	lock_release(pidlock);
+	pi_unlink(zombie);
+	zombie->pi_parent = NULL;
+	lock_release(us->pi_lock);
+
+	pi_drop(zombie);
 }
 
 /*
@@ -355,13 +611,17 @@ pid_setexitstatus(int status)
  * status and ret are a kernel pointers, but pid/flags may come from
  * userland and may thus be maliciously invalid.
  *
+ * THEIRPID may be WAIT_ANY, to wait for whichever child exits first;
+ * the pid found is returned in RET. With WNOHANG, if the child (or
+ * every child) is still running, RET is set to 0.
+ *
  * status may be null, in which case the status is thrown away. ret
  * may only be null if WNOHANG is not set.
  */
 int
 pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 {
-	struct pidinfo *them;
+	struct pidinfo *us, *them;
 
 	KASSERT(curthread->t_pid != INVALID_PID);
 
@@ -371,11 +631,11 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 	}
 
 	/* 
-	 * We don't support the Unix meanings of negative pids or 0
-	 * (0 is INVALID_PID) and other code may break on them, so
-	 * check now.
+	 * We don't support the Unix meanings of other negative pids
+	 * or 0 (0 is INVALID_PID) and other code may break on them,
+	 * so check now.
 	 */
-	if (theirpid == INVALID_PID || theirpid<0) {
+	if (theirpid == INVALID_PID || (theirpid<0 && theirpid != WAIT_ANY)) {
 		return EINVAL;
 	}
 
@@ -384,51 +644,62 @@ pid_wait(pid_t theirpid, int *status, int flags, pid_t *ret)
 		return EINVAL;
 	}
 
-	lock_acquire(pidlock);
+	us = pi_self();
+
+	if (theirpid == WAIT_ANY) {
+		lock_acquire(us->pi_lock);
+		while (us->pi_zombies == NULL) {
+			if (us->pi_children == NULL) {
+				lock_release(us->pi_lock);
+				return ECHILD;
+			}
+			if (flags==WNOHANG) {
+				lock_release(us->pi_lock);
+				KASSERT(ret!=NULL);
+				*ret = 0;
+				return 0;
+			}
+			cv_wait(us->pi_cv, us->pi_lock);
+		}
+		pi_reap(us, us->pi_zombies, status, ret);
+		return 0;
+	}
+
+	/*
+	 * Look them up with the table locked for reading, and keep it
+	 * until we've checked they're ours: if they aren't, their
+	 * parent might free them as soon as we let go. If they are,
+	 * only we can free them.
+	 */
+	rwlock_acquire_read(pidlock);
 
 	them = pi_get(theirpid);
 	if (them==NULL) {
-		lock_release(pidlock);
+		rwlock_release_read(pidlock);
 		return ESRCH;
 	}
 
-	KASSERT(them->pi_pid==theirpid);
+	lock_acquire(us->pi_lock);
 
 	/* Only allow waiting for own children. */
-	if (them->pi_ppid != curthread->t_pid) {
-		lock_release(pidlock);
+	if (them->pi_parent != us) {
+		lock_release(us->pi_lock);
+		rwlock_release_read(pidlock);
 		return EPERM;
 	}
+	rwlock_release_read(pidlock);
 
-	if (them->pi_exited==0) {
+	while (them->pi_exited==0) {
 		if (flags==WNOHANG) {
-			lock_release(pidlock);
+			lock_release(us->pi_lock);
 			KASSERT(ret!=NULL);
 			*ret = 0;
 			return 0;
 		}
-		/* don't need to loop on this */
-		cv_wait(them->pi_cv, pidlock);
-		KASSERT(them->pi_exited==1);
-	}
-
-	if (status != NULL) {
-		*status = them->pi_exitstatus;
+		/* any child exiting wakes us; go back to sleep if not them */
+		cv_wait(us->pi_cv, us->pi_lock);
 	}
-	if (ret != NULL) {
-		/* 
-		 * In Unix you can wait for any of several possible
-		 * processes by passing particular magic values of
-		 * pid. wait then returns the pid you actually
-		 * found. We don't support this, so always return the
-		 * pid we looked for.
-		 */
-		*ret = theirpid;
-	}
-
-	them->pi_ppid = 0;
-	pi_drop(them->pi_pid);
 
-	lock_release(pidlock);
+	pi_reap(us, them, status, ret);
 	return 0;
 }
@@ -48,8 +48,12 @@
 void
 spinlock_init(struct spinlock *lk)
 {
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lockstat_init(&lk->lk_stat, LOCKSTAT_SPINLOCK, NULL);
+#endif
 }
 
 /*
@@ -59,7 +63,11 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
+#if OPT_LOCKSTAT
+	lockstat_cleanup(&lk->lk_stat);
+#endif
 }
 
 /*
@@ -67,12 +75,17 @@ spinlock_cleanup(struct spinlock *lk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket, and wait for it to come up.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_LOCKSTAT
+	uint64_t start = 0;
+	bool contended;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +100,34 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
-		}
-		break;
+	/*
+	 * Fetch-and-increment is a machine-level atomic operation
+	 * that adds 1 to the word and returns the previous value;
+	 * that's our place in line. Then just read lk_serving until
+	 * it's our turn. Only the holder writes lk_serving, so this
+	 * spins in the cache until the lock is handed to someone.
+	 */
+#if OPT_LOCKSTAT
+	if (mycpu != NULL) {
+		start = lockstat_now();
+	}
+#endif
+	ticket = spinlock_data_fetchinc(&lk->lk_next);
+#if OPT_LOCKSTAT
+	contended = spinlock_data_get(&lk->lk_serving) != ticket;
+#endif
+	while (spinlock_data_get(&lk->lk_serving) != ticket) {
+		/* spin */
 	}
 
 	lk->lk_holder = mycpu;
+#if OPT_LOCKSTAT
+	/* the cycle counter needs curcpu */
+	if (mycpu != NULL) {
+		lockstat_acquired(&lk->lk_stat, contended, start,
+				  __builtin_return_address(0));
+	}
+#endif
 }
 
 /*
@@ -119,10 +139,15 @@ spinlock_release(struct spinlock *lk)
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
 		KASSERT(lk->lk_holder == curcpu->c_self);
+#if OPT_LOCKSTAT
+		lockstat_released(&lk->lk_stat);
+#endif
 	}
 
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	/* Only the holder changes lk_serving, so no atomic op is needed. */
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -38,8 +38,18 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
 #include <synch.h>
 
+/*
+ * Number of times lock_acquire polls a lock whose holder is running
+ * on another cpu before giving up and going to sleep. Most critical
+ * sections are a few hundred cycles, so the holder usually lets go
+ * well before this runs out; if it doesn't, it's probably going to
+ * be a while and we may as well let something else run.
+ */
+#define LOCK_SPINS	1000
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -171,6 +181,9 @@ lock_create(const char *name)
         }
         spinlock_init(&lock->lk_lock);
         lock->lk_holder = NULL;
+#if OPT_LOCKSTAT
+        lockstat_init(&lock->lk_stat, LOCKSTAT_LOCK, lock->lk_name);
+#endif
         
         return lock;
 }
@@ -181,6 +194,9 @@ lock_destroy(struct lock *lock)
         DEBUGASSERT(lock != NULL);
         DEBUGASSERT(lock->lk_holder == NULL);
 
+#if OPT_LOCKSTAT
+        lockstat_cleanup(&lock->lk_stat);
+#endif
         spinlock_cleanup(&lock->lk_lock);
         wchan_destroy(lock->lk_wchan);
         
@@ -191,12 +207,43 @@ lock_destroy(struct lock *lock)
 void
 lock_acquire(struct lock *lock)
 {
+        struct thread *holder;
+        unsigned spins;
+#if OPT_LOCKSTAT
+        uint64_t start;
+        bool contended = false;
+
+        start = lockstat_now();
+#endif
+
         DEBUGASSERT(lock != NULL);
         DEBUGASSERT(!(lock_do_i_hold(lock)));
         KASSERT(curthread->t_in_interrupt == false);
  
         spinlock_acquire(&lock->lk_lock);
-        while (lock->lk_holder != NULL) {
+        spins = LOCK_SPINS;
+        while ((holder = lock->lk_holder) != NULL) {
+#if OPT_LOCKSTAT
+                contended = true;
+#endif
+                /*
+                 * If the holder is running on another cpu, it will
+                 * probably release soon; wait for that instead of
+                 * paying for two context switches. The holder can't
+                 * go away while we have lk_lock, so it's safe to look
+                 * at it here, but not once we let go; so spin just
+                 * on lk_holder changing.
+                 */
+                if (spins > 0 && holder->t_state == S_RUN &&
+                    holder->t_cpu != curcpu->c_self) {
+                        spinlock_release(&lock->lk_lock);
+                        while (lock->lk_holder == holder && spins > 0) {
+                                spins--;
+                        }
+                        spinlock_acquire(&lock->lk_lock);
+                        continue;
+                }
+
                 wchan_lock(lock->lk_wchan);
                 spinlock_release(&lock->lk_lock);
                 wchan_sleep(lock->lk_wchan);
@@ -205,6 +252,12 @@ lock_acquire(struct lock *lock)
 
         lock->lk_holder = curthread;
         spinlock_release(&lock->lk_lock);
+
+#if OPT_LOCKSTAT
+        /* We hold the lock, so nobody else is touching the stats. */
+        lockstat_acquired(&lock->lk_stat, contended, start,
+                          __builtin_return_address(0));
+#endif
 }
 
 void
@@ -212,6 +265,10 @@ lock_release(struct lock *lock)
 {
         DEBUGASSERT(lock_do_i_hold(lock));
 
+#if OPT_LOCKSTAT
+        lockstat_released(&lock->lk_stat);
+#endif
+
         spinlock_acquire(&lock->lk_lock);
         lock->lk_holder = NULL;
         wchan_wakeone(lock->lk_wchan);
@@ -258,6 +315,9 @@ cv_create(const char *name)
                 kfree(cv);
                 return NULL;
         }
+#if OPT_LOCKSTAT
+        lockstat_init(&cv->cv_stat, LOCKSTAT_CV, cv->cv_name);
+#endif
         
         return cv;
 }
@@ -267,6 +327,9 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
+#if OPT_LOCKSTAT
+        lockstat_cleanup(&cv->cv_stat);
+#endif
         wchan_destroy(cv->cv_wchan);
         kfree(cv->cv_name);
         kfree(cv);
@@ -275,12 +338,29 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+#if OPT_LOCKSTAT
+        uint64_t start;
+#endif
+
         DEBUGASSERT(lock_do_i_hold(lock));
 
+#if OPT_LOCKSTAT
+        start = lockstat_now();
+#endif
         wchan_lock(cv->cv_wchan);
         lock_release(lock);
         wchan_sleep(cv->cv_wchan);
         lock_acquire(lock);
+
+#if OPT_LOCKSTAT
+        /*
+         * Every wait blocks, so count them all as contended; the
+         * wait time is how long we slept. The hold time means
+         * nothing for a cv, so don't record releases.
+         */
+        lockstat_acquired(&cv->cv_stat, true, start,
+                          __builtin_return_address(0));
+#endif
 }
  
 void
@@ -298,3 +378,148 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 
         wchan_wakeall(cv->cv_wchan);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rwlock_name = kstrdup(name);
+        if (rw->rwlock_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_readwchan = wchan_create(rw->rwlock_name);
+        if (rw->rw_readwchan == NULL) {
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_writewchan = wchan_create(rw->rwlock_name);
+        if (rw->rw_writewchan == NULL) {
+                wchan_destroy(rw->rw_readwchan);
+                kfree(rw->rwlock_name);
+                kfree(rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_lock);
+        rw->rw_readers = 0;
+        rw->rw_writing = false;
+        rw->rw_waitreaders = 0;
+        rw->rw_waitwriters = 0;
+
+        return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(!rw->rw_writing);
+        KASSERT(rw->rw_waitreaders == 0);
+        KASSERT(rw->rw_waitwriters == 0);
+
+        spinlock_cleanup(&rw->rw_lock);
+        wchan_destroy(rw->rw_writewchan);
+        wchan_destroy(rw->rw_readwchan);
+
+        kfree(rw->rwlock_name);
+        kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_lock);
+        if (!rw->rw_writing && rw->rw_waitwriters == 0) {
+                rw->rw_readers++;
+                spinlock_release(&rw->rw_lock);
+                return;
+        }
+
+        /*
+         * Wait for a writer to hand us the lock. The wchan must be
+         * locked before rw_lock is released, so the handoff can't
+         * happen before we're on it.
+         */
+        rw->rw_waitreaders++;
+        wchan_lock(rw->rw_readwchan);
+        spinlock_release(&rw->rw_lock);
+        wchan_sleep(rw->rw_readwchan);
+
+        /* rwlock_release_write counted us in rw_readers. */
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        KASSERT(!rw->rw_writing);
+
+        rw->rw_readers--;
+        if (rw->rw_readers == 0 && rw->rw_waitwriters > 0) {
+                rw->rw_waitwriters--;
+                rw->rw_writing = true;
+                wchan_wakeone(rw->rw_writewchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_lock);
+        if (!rw->rw_writing && rw->rw_readers == 0) {
+                /* if nobody holds it, nobody can be waiting either */
+                KASSERT(rw->rw_waitwriters == 0);
+                rw->rw_writing = true;
+                spinlock_release(&rw->rw_lock);
+                return;
+        }
+
+        rw->rw_waitwriters++;
+        wchan_lock(rw->rw_writewchan);
+        spinlock_release(&rw->rw_lock);
+        wchan_sleep(rw->rw_writewchan);
+
+        /* Whoever woke us set rw_writing on our behalf. */
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_writing);
+        KASSERT(rw->rw_readers == 0);
+
+        rw->rw_writing = false;
+        if (rw->rw_waitreaders > 0) {
+                rw->rw_readers = rw->rw_waitreaders;
+                rw->rw_waitreaders = 0;
+                wchan_wakeall(rw->rw_readwchan);
+        }
+        else if (rw->rw_waitwriters > 0) {
+                rw->rw_waitwriters--;
+                rw->rw_writing = true;
+                wchan_wakeone(rw->rw_writewchan);
+        }
+        spinlock_release(&rw->rw_lock);
+}
@@ -49,14 +49,53 @@
 #include <vnode.h>
 #include <pid.h>
 #include <file.h>
+#include <clock.h>
 
 #include "opt-synchprobs.h"
 #include "opt-defaultscheduler.h"
 
 
+/*
+ * Scheduler tuning (used only when the default scheduler is off).
+ *
+ * A thread at priority level N may use SCHED_ALLOTMENT(N) hardclocks
+ * before it is demoted one level. Every SCHED_AGING_HARDCLOCKS, each
+ * cpu moves every thread on its lower run queues up one level so that
+ * nothing starves. (This must be a multiple of SCHEDULE_HARDCLOCKS in
+ * clock.c, since that's how often schedule() looks.)
+ */
+#define SCHED_ALLOTMENT(prio)	(5U << (prio))
+#define SCHED_AGING_HARDCLOCKS	HZ
+
+/*
+ * Timeslice: the number of hardclocks a thread at priority level N
+ * runs before it is made to yield to another thread waiting for the
+ * same cpu. The default scheduler keeps everything at level 0, which
+ * gives plain one-tick round robin.
+ */
+#define SCHED_TIMESLICE(prio)	(1U << (prio))
+
+/*
+ * Load balancing is pull-based: a cpu that runs out of work steals
+ * from another cpu's run queue. To keep that cheap on a machine with
+ * many cpus, a steal only looks at STEAL_PROBES other cpus, starting
+ * with the one after the stealer.
+ */
+#define STEAL_PROBES		4
+
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Maximum number of idle kernel stacks kept in the stack pool. Stacks
+ * freed when the pool is full go back to kmalloc. The pool only has to
+ * absorb the ordinary churn of processes exiting and being forked again
+ * (a shell pipeline, a batch of test programs), and at STACK_SIZE each
+ * 32 stacks pin just 128K while idle; a fork storm bigger than that
+ * just falls back to the old allocate-per-fork behavior.
+ */
+#define STACKPOOL_MAX 32
+
 /* Wait channel. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -72,6 +111,21 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/*
+ * Pool of free kernel stacks. The stacks are chained through their
+ * top word (which is the first thing a new thread overwrites) so the
+ * guard band at the bottom set by thread_checkstack_init stays intact
+ * while a stack sits in the pool.
+ */
+static struct spinlock stackpool_lock = SPINLOCK_INITIALIZER;
+static void *stackpool_head;
+static unsigned stackpool_count;
+
+/* Scheduler hooks, below. */
+static void schedule_charge(struct thread *t);
+static void schedule_wakeup(struct thread *t);
+static void thread_kick_idle(struct cpu *busy);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -89,6 +143,85 @@ thread_checkstack_init(struct thread *thread)
 	((uint32_t *)thread->t_stack)[3] = THREAD_STACK_MAGIC;
 }
 
+/*
+ * Check whether the guard band on a stack is still intact. Unlike
+ * thread_checkstack this doesn't assert, so it still works with
+ * noasserts; it's used to decide whether a stack can be recycled.
+ */
+static
+bool
+thread_stack_isintact(void *stack)
+{
+	return ((uint32_t *)stack)[0] == THREAD_STACK_MAGIC &&
+		((uint32_t *)stack)[1] == THREAD_STACK_MAGIC &&
+		((uint32_t *)stack)[2] == THREAD_STACK_MAGIC &&
+		((uint32_t *)stack)[3] == THREAD_STACK_MAGIC;
+}
+
+/*
+ * Get a kernel stack for THREAD, preferably from the stack pool.
+ * Stacks from the pool already have their guard band set up; only
+ * freshly kmalloc'd ones need thread_checkstack_init.
+ */
+static
+int
+thread_stack_alloc(struct thread *thread)
+{
+	void *stack;
+
+	spinlock_acquire(&stackpool_lock);
+	stack = stackpool_head;
+	if (stack != NULL) {
+		stackpool_head = *(void **)((char *)stack + STACK_SIZE
+					    - sizeof(void *));
+		stackpool_count--;
+	}
+	spinlock_release(&stackpool_lock);
+
+	if (stack != NULL) {
+		thread->t_stack = stack;
+		return 0;
+	}
+
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack == NULL) {
+		return ENOMEM;
+	}
+	thread_checkstack_init(thread);
+	return 0;
+}
+
+/*
+ * Give back THREAD's kernel stack. It goes into the stack pool unless
+ * the pool is full or the guard band has been trampled, in which case
+ * it goes back to kfree.
+ */
+static
+void
+thread_stack_free(struct thread *thread)
+{
+	void *stack;
+
+	stack = thread->t_stack;
+	thread->t_stack = NULL;
+
+	if (thread_stack_isintact(stack)) {
+		spinlock_acquire(&stackpool_lock);
+		if (stackpool_count < STACKPOOL_MAX) {
+			*(void **)((char *)stack + STACK_SIZE
+				   - sizeof(void *)) = stackpool_head;
+			stackpool_head = stack;
+			stackpool_count++;
+			stack = NULL;
+		}
+		spinlock_release(&stackpool_lock);
+	}
+
+	if (stack != NULL) {
+		kfree(stack);
+	}
+}
+
 /*
  * Check the magic number we put on the bottom end of the stack in
  * thread_checkstack_init. If these KASSERTions go off, it most likely
@@ -139,10 +272,16 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_wchan = NULL;
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 
+	/* Scheduler fields; new threads start at the top level */
+	thread->t_priority = 0;
+	thread->t_cpuclocks = 0;
+	thread->t_runstart = 0;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -173,6 +312,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -186,9 +326,14 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_slicestart = 0;
+	c->c_tickless = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<NPRIORITIES; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -216,11 +361,9 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
-		if (c->c_curthread->t_stack == NULL) {
+		if (thread_stack_alloc(c->c_curthread)) {
 			panic("cpu_create: couldn't allocate stack");
 		}
-		thread_checkstack_init(c->c_curthread);
 	}
 	c->c_curthread->t_cpu = c;
 
@@ -229,6 +372,15 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Return the number of cpus in the system.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
 /*
  * Destroy a thread.
  *
@@ -257,7 +409,7 @@ thread_destroy(struct thread *thread)
 	
 	/* Thread subsystem fields */
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		thread_stack_free(thread);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -298,6 +450,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -312,9 +466,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (i=0; i<NPRIORITIES; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -443,6 +600,179 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue operations. The cpu's runqueue lock must be held.
+ *
+ * Each cpu has one queue per priority level; threads are queued on
+ * the level given by their t_priority and taken from the highest
+ * (lowest-numbered) nonempty level.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < NPRIORITIES);
+
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+	c->c_runcount++;
+}
+
+/*
+ * Return the highest priority level with a thread on it, or
+ * NPRIORITIES if the cpu has nothing runnable.
+ */
+static
+unsigned
+runqueue_toppriority(struct cpu *c)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<NPRIORITIES; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* Take the next thread to run: the head of the highest level. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	unsigned i;
+
+	i = runqueue_toppriority(c);
+	if (i == NPRIORITIES) {
+		return NULL;
+	}
+	c->c_runcount--;
+	return threadlist_remhead(&c->c_runqueue[i]);
+}
+
+/* Take the thread that would run last: the tail of the lowest level. */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=NPRIORITIES; i-- > 0; ) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			c->c_runcount--;
+			return threadlist_remtail(&c->c_runqueue[i]);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Work stealing.
+ *
+ * Look at up to STEAL_PROBES cpus other than this one and take the
+ * thread at the tail of the busiest run queue, if that queue has at
+ * least MINCOUNT threads on it. The stolen thread is reassigned to
+ * this cpu and returned; the caller must put it on a run queue or run
+ * it. Returns NULL if there was nothing worth stealing.
+ *
+ * The peers' run queue counts are read without their locks, as hints;
+ * only the chosen victim is locked. The caller must not hold its own
+ * runqueue lock, since two cpus stealing from each other would
+ * deadlock.
+ */
+static
+struct thread *
+thread_steal(unsigned mincount)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, probes, count, best;
+
+	KASSERT(!spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	numcpus = cpuarray_num(&allcpus);
+	probes = numcpus - 1;
+	if (probes > STEAL_PROBES) {
+		probes = STEAL_PROBES;
+	}
+
+	victim = NULL;
+	best = 0;
+	for (i=1; i<=probes; i++) {
+		c = cpuarray_get(&allcpus, (curcpu->c_number + i) % numcpus);
+		count = c->c_runcount;
+		if (count >= mincount && count > best) {
+			victim = c;
+			best = count;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	if (victim->c_runcount < mincount) {
+		/* Someone got there first. */
+		spinlock_release(&victim->c_runqueue_lock);
+		return NULL;
+	}
+	t = runqueue_remtail(victim);
+	KASSERT(t != NULL);
+	if (t == victim->c_curthread) {
+		/*
+		 * The victim went idle on this thread's stack and
+		 * it has been woken up but the victim hasn't switched
+		 * away from it yet. Migrating it now would be fatal
+		 * (see thread_consider_migration) so leave it alone.
+		 */
+		runqueue_add(victim, t);
+		spinlock_release(&victim->c_runqueue_lock);
+		return NULL;
+	}
+	t->t_cpu = curcpu->c_self;
+	spinlock_release(&victim->c_runqueue_lock);
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+
+	return t;
+}
+
+/*
+ * BUSY has just been given a thread it can't run right away. If one
+ * of the nearby cpus is idle, poke it so it comes out of cpu_idle and
+ * steals the thread instead of waiting for a timer interrupt.
+ *
+ * c_isidle is read without the runqueue lock; a wrong guess costs
+ * either a spurious IPI or a short wait.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i, numcpus, probes;
+
+	numcpus = cpuarray_num(&allcpus);
+	probes = numcpus - 1;
+	if (probes > STEAL_PROBES) {
+		probes = STEAL_PROBES;
+	}
+
+	for (i=1; i<=probes; i++) {
+		c = cpuarray_get(&allcpus, (busy->c_number + i) % numcpus);
+		if (c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -467,7 +797,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -475,6 +805,13 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else {
+		/*
+		 * The target has to wait for its cpu; if some other
+		 * cpu is idle, wake it up so it can steal the thread.
+		 */
+		thread_kick_idle(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -487,16 +824,20 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * The new thread has name NAME, and starts executing in function
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
- * The new thread is given no address space (the caller decides that)
- * but inherits its current working directory from the caller. It will
- * start on the same CPU as the caller, unless the scheduler
- * intervenes first.
+ * If CHILDPID is non-null the new thread gets the caller's address
+ * space and file table: copies of them, or the same ones with another
+ * reference if SHARE is set. If AS is non-null, the new thread gets
+ * that address space instead of one derived from the caller's; on
+ * success the reference to it passes to the new thread. It also
+ * inherits the caller's current working directory. It will start on
+ * the same CPU as the caller, unless the scheduler intervenes first.
  */
+static
 int
-thread_fork(const char *name,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2,
-	    pid_t *childpid)
+thread_fork_common(const char *name,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2,
+		   pid_t *childpid, bool share, struct addrspace *as)
 {
 	struct thread *newthread;
 	int result;
@@ -506,13 +847,12 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
+	/* Allocate a stack (from the stack pool if possible) */
+	result = thread_stack_alloc(newthread);
+	if (result) {
 		thread_destroy(newthread);
-		return ENOMEM;
+		return result;
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -537,17 +877,32 @@ thread_fork(const char *name,
 		 * Copy stuff from the parent thread to the child.
 		 */
 		
-		if (curthread->t_filetable != NULL) {
-			result = filetable_copy(&newthread->t_filetable);
-			if (result) {
-				goto fail1;
+		if (share) {
+			if (curthread->t_filetable != NULL) {
+				filetable_incref(curthread->t_filetable);
+				newthread->t_filetable = curthread->t_filetable;
+			}
+			if (curthread->t_addrspace != NULL) {
+				as_incref(curthread->t_addrspace);
+				newthread->t_addrspace = curthread->t_addrspace;
 			}
 		}
+		else {
+			if (curthread->t_filetable != NULL) {
+				result = filetable_copy(&newthread->t_filetable);
+				if (result) {
+					goto fail1;
+				}
+			}
 
-		if (curthread->t_addrspace) {
-			result = as_copy(curthread->t_addrspace, &newthread->t_addrspace);
-			if (result) {
-				goto fail2;
+			if (as != NULL) {
+				newthread->t_addrspace = as;
+			}
+			else if (curthread->t_addrspace) {
+				result = as_copy(curthread->t_addrspace, &newthread->t_addrspace);
+				if (result) {
+					goto fail2;
+				}
 			}
 		}
 	}
@@ -602,6 +957,55 @@ fail0:
 	return result;
 }
 
+/*
+ * Fork a thread. If CHILDPID is non-null, the new thread is a new
+ * process with its own copy of the caller's address space and file
+ * table; otherwise it's a kernel-only thread with neither.
+ */
+int
+thread_fork(const char *name,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2,
+	    pid_t *childpid)
+{
+	return thread_fork_common(name, entrypoint, data1, data2, childpid,
+				  false, NULL);
+}
+
+/*
+ * Fork another thread of the caller's process: it shares the
+ * caller's address space and file table instead of copying them.
+ * The new thread's pid is returned in CHILDPID.
+ */
+int
+thread_fork_shared(const char *name,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2,
+		   pid_t *childpid)
+{
+	KASSERT(childpid != NULL);
+	return thread_fork_common(name, entrypoint, data1, data2, childpid,
+				  true, NULL);
+}
+
+/*
+ * Fork a new process that runs in the already-loaded address space
+ * AS rather than a copy of the caller's. It gets a copy of the
+ * caller's file table as usual. On success AS belongs to the new
+ * process; on failure it still belongs to the caller.
+ */
+int
+thread_fork_as(const char *name,
+	       void (*entrypoint)(void *data1, unsigned long data2),
+	       void *data1, unsigned long data2,
+	       struct addrspace *as, pid_t *childpid)
+{
+	KASSERT(as != NULL);
+	KASSERT(childpid != NULL);
+	return thread_fork_common(name, entrypoint, data1, data2, childpid,
+				  false, as);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -641,8 +1045,17 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/* Account for the cpu time the thread has used. */
+	schedule_charge(cur);
+
+	/*
+	 * Micro-optimization: if nothing to do, just return. This
+	 * includes the case where everything runnable has lower
+	 * priority than we do.
+	 */
+	if (newstate == S_READY &&
+	    runqueue_toppriority(curcpu) > cur->t_priority) {
+		curcpu->c_slicestart = curcpu->c_hardclocks;
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -671,6 +1084,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		 * without racing. Exercise: what's the other?)
 		 */
 		threadlist_addtail(&wc->wc_threads, cur);
+		cur->t_wchan = wc;
 		wchan_unlock(wc);
 		break;
 	    case S_ZOMBIE:
@@ -681,10 +1095,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, try to steal
+	 * one from another cpu, and failing that call md_idle().
 	 * curcpu->c_isidle must be true when md_idle is
-	 * called. Unlock the runqueue while idling too, to make sure
-	 * things can be added to it.
+	 * called. Unlock the runqueue while stealing and idling too,
+	 * to make sure things can be added to it.
 	 *
 	 * Note that we don't need to unlock the runqueue atomically
 	 * with idling; becoming unidle requires receiving an
@@ -692,6 +1107,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * interrupt from another cpu posting a wakeup) and idling
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
+	 * While we idle, the periodic hardclock is turned off; see
+	 * clock_idle_enter in clock.c.
+	 *
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
@@ -700,10 +1118,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal(1);
+			if (next == NULL) {
+				clock_idle_enter();
+				cpu_idle();
+				clock_idle_exit();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -772,6 +1195,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Clear the wait channel and set the thread state. */
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
+	cur->t_runstart = curcpu->c_hardclocks;
+	curcpu->c_slicestart = curcpu->c_hardclocks;
 
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -807,6 +1232,8 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clear the wait channel and set the thread state. */
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
+	cur->t_runstart = curcpu->c_hardclocks;
+	curcpu->c_slicestart = curcpu->c_hardclocks;
 
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -870,7 +1297,10 @@ thread_exit(int exitstatus)
 		curthread->t_filetable = NULL;
 	}
 
-	/* VM fields */
+	/*
+	 * VM fields. If other threads share the address space this
+	 * just drops our reference.
+	 */
 	if (cur->t_addrspace) {
 		/*
 		 * Clear t_addrspace before calling as_destroy. Otherwise
@@ -917,21 +1347,184 @@ schedule(void)
 {
   // 28 Feb 2012 : GWA : Leave the default scheduler alone!
 }
+
+static
+void
+schedule_charge(struct thread *t)
+{
+	(void)t;
+}
+
+static
+void
+schedule_wakeup(struct thread *t)
+{
+	(void)t;
+}
 #else
+/*
+ * Multi-level feedback queue.
+ *
+ * Threads start at level 0. A thread that uses up the allotment of
+ * hardclocks for its level is moved down a level; a thread that
+ * wakes up from a wait channel (and so was probably waiting for I/O
+ * or for the user) is moved up a level. Because thread_switch always
+ * picks from the highest nonempty level, interactive threads run
+ * ahead of cpu hogs, which sink to the bottom and share it round
+ * robin. Periodic aging in schedule() moves everything back up so
+ * the hogs don't starve.
+ */
+
+/*
+ * Charge T for the hardclocks it has used since it was last charged,
+ * and demote it if it has used up its allotment. T must be curthread
+ * and the runqueue lock must be held.
+ */
+static
+void
+schedule_charge(struct thread *t)
+{
+	unsigned now;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	now = curcpu->c_hardclocks;
+	t->t_cpuclocks += now - t->t_runstart;
+	t->t_runstart = now;
+
+	if (t->t_cpuclocks >= SCHED_ALLOTMENT(t->t_priority)) {
+		if (t->t_priority < NPRIORITIES - 1) {
+			t->t_priority++;
+		}
+		t->t_cpuclocks = 0;
+	}
+}
+
+/*
+ * Boost a thread that is being woken up from a wait channel. The
+ * thread is not on any run queue yet, so no lock is needed.
+ */
+static
+void
+schedule_wakeup(struct thread *t)
+{
+	if (t->t_priority > 0) {
+		t->t_priority--;
+	}
+	t->t_cpuclocks = 0;
+}
+
 void
 schedule(void)
 {
-  // 28 Feb 2012 : GWA : Implement your scheduler that prioritizes
-  // "interactive" threads here.
+	struct thread *t;
+	unsigned i;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	if (!curcpu->c_isidle) {
+		schedule_charge(curthread);
+	}
+
+	if (curcpu->c_hardclocks % SCHED_AGING_HARDCLOCKS == 0) {
+		/*
+		 * Age: move each level up one, top to bottom, so
+		 * nothing moves more than one level per pass.
+		 */
+		for (i=1; i<NPRIORITIES; i++) {
+			while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+			       != NULL) {
+				t->t_priority = i - 1;
+				t->t_cpuclocks = 0;
+				threadlist_addtail(&curcpu->c_runqueue[i-1], t);
+			}
+		}
+		if (!curcpu->c_isidle && curthread->t_priority > 0) {
+			curthread->t_priority--;
+			curthread->t_cpuclocks = 0;
+		}
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
 #endif
 
+/*
+ * Decide at a hardclock whether the current thread should give up
+ * the cpu. If nothing else is waiting for this cpu there's no point:
+ * we'd only switch back to the same thread, taking the runqueue lock
+ * and reloading the address space to do it. Otherwise yield when the
+ * timeslice is up, or right away if something of higher priority is
+ * waiting.
+ *
+ * c_runcount is checked without the lock first so that the common
+ * single-thread case doesn't touch it; a thread made runnable just
+ * after we look gets noticed at the next hardclock.
+ */
+bool
+thread_preempt_due(void)
+{
+	struct thread *cur = curthread;
+	bool ret;
+
+	if (curcpu->c_isidle || curcpu->c_runcount == 0) {
+		return false;
+	}
+	if (curcpu->c_hardclocks - curcpu->c_slicestart >=
+	    SCHED_TIMESLICE(cur->t_priority)) {
+		return true;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	ret = runqueue_toppriority(curcpu) < cur->t_priority;
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return ret;
+}
+
+/*
+ * Print the run queues of every cpu.
+ *
+ * The counts are copied out under the runqueue lock and printed
+ * afterwards, so they're a snapshot and may be stale by the time
+ * they appear.
+ */
+void
+schedule_printstats(void)
+{
+	unsigned counts[NPRIORITIES];
+	unsigned i, j, numcpus, hardclocks;
+	bool isidle;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		for (j=0; j<NPRIORITIES; j++) {
+			counts[j] = c->c_runqueue[j].tl_count;
+		}
+		isidle = c->c_isidle;
+		hardclocks = c->c_hardclocks;
+		spinlock_release(&c->c_runqueue_lock);
+
+		kprintf("cpu%u: %s, %u hardclocks; run queues:",
+			c->c_number, isidle ? "idle" : "busy", hardclocks);
+		for (j=0; j<NPRIORITIES; j++) {
+			kprintf(" %u", counts[j]);
+		}
+		kprintf("\n");
+	}
+}
+
 /*
  * Thread migration.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * This is also called periodically from hardclock(). Idle cpus pull
+ * work for themselves in thread_switch, but a cpu that always has
+ * something to run never goes looking, so a busy cpu next to a much
+ * busier one would stay unbalanced. So here, if some nearby cpu has at
+ * least two more threads waiting than we do, pull one across.
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
@@ -940,112 +1533,23 @@ schedule(void)
  * something that needs to be tuned and probably is workload-specific.
  *
  * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
+ * System/161 does not (yet) model such cache effects, we'll be fairly
  * aggressive.
  */
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
 	struct thread *t;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
-	}
-
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	/* Unlocked read; it's only a hint, like in thread_steal. */
+	t = thread_steal(curcpu->c_runcount + 2);
+	if (t == NULL) {
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
-	}
+	runqueue_add(curcpu, t);
 	spinlock_release(&curcpu->c_runqueue_lock);
-
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
-		spinlock_release(&c->c_runqueue_lock);
-	}
-
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
-	}
-
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
 }
 
 ////////////////////////////////////////////////////////////
@@ -1119,6 +1623,73 @@ wchan_sleep(struct wchan *wc)
 	thread_switch(S_SLEEP, wc);
 }
 
+/*
+ * State shared between a thread in wchan_sleep_timeout and its
+ * timeout callout. Lives on the sleeper's stack.
+ */
+struct wchan_timeout {
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	bool wt_expired;
+};
+
+/*
+ * Timeout callout: if the thread is still asleep on the channel, take
+ * it off and wake it ourselves. If it's not on the channel, someone
+ * else already woke it and we have nothing to do.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *target = wt->wt_thread;
+	struct wchan *wc = wt->wt_wchan;
+
+	spinlock_acquire(&wc->wc_lock);
+	if (target->t_wchan == wc) {
+		threadlist_remove(&wc->wc_threads, target);
+		target->t_wchan = NULL;
+		wt->wt_expired = true;
+	}
+	spinlock_release(&wc->wc_lock);
+
+	if (wt->wt_expired) {
+		thread_make_runnable(target, false);
+	}
+}
+
+/*
+ * Sleep on a wait channel as with wchan_sleep, but for at most TICKS
+ * hardclocks. Returns ETIMEDOUT if nobody woke us first.
+ */
+int
+wchan_sleep_timeout(struct wchan *wc, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	struct callout co;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	wt.wt_thread = curthread;
+	wt.wt_wchan = wc;
+	wt.wt_expired = false;
+
+	/*
+	 * The callout can't get past taking the channel lock until
+	 * we're on the sleep list, so it can't miss us.
+	 */
+	callout_init(&co);
+	callout_schedule(&co, ticks, wchan_timeout, &wt);
+	thread_switch(S_SLEEP, wc);
+
+	/* Make sure the callout is done with wt and co before we return. */
+	callout_cancel(&co);
+
+	return wt.wt_expired ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1130,6 +1701,9 @@ wchan_wakeone(struct wchan *wc)
 	/* Lock the channel and grab a thread from it */
 	spinlock_acquire(&wc->wc_lock);
 	target = threadlist_remhead(&wc->wc_threads);
+	if (target != NULL) {
+		target->t_wchan = NULL;
+	}
 	/*
 	 * Nobody else can wake up this thread now, so we don't need
 	 * to hang onto the lock.
@@ -1141,6 +1715,7 @@ wchan_wakeone(struct wchan *wc)
 		return;
 	}
 
+	schedule_wakeup(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1161,6 +1736,7 @@ wchan_wakeall(struct wchan *wc)
 	 */
 	spinlock_acquire(&wc->wc_lock);
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
 		threadlist_addtail(&list, target);
 	}
 	/*
@@ -1175,6 +1751,7 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		schedule_wakeup(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -229,6 +229,21 @@ dev_tryseek(struct vnode *v, off_t pos)
 	return 0;
 }
 
+/*
+ * Poll: pass it along to the device, if it cares.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, int *revents, struct pollwait *pw)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_poll == NULL) {
+		return vnode_poll_ready(v, events, revents, pw);
+	}
+	return d->d_poll(d, events, revents, pw);
+}
+
 /*
  * For fsync() - meaningless, do nothing.
  */
@@ -426,6 +441,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	dev_stat,
 	dev_gettype,
 	dev_tryseek,
+	dev_poll,
 	null_fsync,
 	dev_mmap,
 	dev_truncate,
@@ -0,0 +1,600 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes.
+ *
+ * A pipe is a fixed-size ring buffer in the kernel with two vnodes
+ * attached, one for each end, so the file table and the read and
+ * write system calls handle pipes like any other open file. Nothing
+ * ever touches a filesystem.
+ *
+ * Readers sleep on p_readcv while the pipe is empty and writers on
+ * p_writecv while it's full. A write of PIPE_BUF bytes or less waits
+ * until there's room for all of it, so it's never split up or
+ * interleaved with another write; bigger writes go in as space opens
+ * up. Reading an empty pipe whose write end has been closed returns
+ * end of file, and writing to a pipe whose read end has been closed
+ * fails with EPIPE.
+ *
+ * Anything that changes what poll would say about either end calls
+ * pollq_wakeup on p_pollq, holding p_lock, and pipe_poll registers
+ * holding p_lock, so no change slips by between a poller's look and
+ * its registration.
+ *
+ * The last close of an end comes from vfs_close, which holds
+ * vfs_biglock, so p_lock is taken after vfs_biglock. Nothing here
+ * takes vfs_biglock while holding p_lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/poll.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+/* size of the ring buffer */
+#define PIPE_SIZE 4096
+
+struct pipe {
+	struct vnode p_readvn;		/* read end */
+	struct vnode p_writevn;		/* write end */
+
+	struct lock *p_lock;		/* protects everything below */
+	struct cv *p_readcv;		/* readers wait here for data */
+	struct cv *p_writecv;		/* writers wait here for space */
+	struct pollq p_pollq;		/* pollers of either end */
+
+	char *p_buf;			/* the ring buffer */
+	unsigned p_start;		/* where the next read comes from */
+	unsigned p_count;		/* bytes in the buffer */
+
+	bool p_readopen;		/* read end still open */
+	bool p_writeopen;		/* write end still open */
+	unsigned p_nvnodes;		/* ends not yet reclaimed */
+};
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	kfree(p->p_buf);
+	pollq_cleanup(&p->p_pollq);
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p);
+}
+
+/*
+ * Called for each open(). Pipes don't get opened by name, so this
+ * can't happen.
+ */
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+/*
+ * Called on the last close of an end. Wake up anyone on the other
+ * end, who will now see end of file or EPIPE.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	lock_acquire(p->p_lock);
+	if (v == &p->p_readvn) {
+		p->p_readopen = false;
+		cv_broadcast(p->p_writecv, p->p_lock);
+	}
+	else {
+		p->p_writeopen = false;
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+	pollq_wakeup(&p->p_pollq);
+	lock_release(p->p_lock);
+	return 0;
+}
+
+/*
+ * Called when an end goes away for good. The pipe itself goes away
+ * with the second end.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	lock_acquire(p->p_lock);
+	KASSERT(p->p_nvnodes > 0);
+	p->p_nvnodes--;
+	last = (p->p_nvnodes == 0);
+	lock_release(p->p_lock);
+
+	VOP_CLEANUP(v);
+
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * Move up to LEN bytes between the ring buffer at position POS and
+ * the uio, in at most two pieces in case it wraps. p_lock must be
+ * held.
+ */
+static
+int
+pipe_move(struct pipe *p, unsigned pos, size_t len, struct uio *uio)
+{
+	size_t len1;
+	int result;
+
+	pos %= PIPE_SIZE;
+	len1 = len;
+	if (pos + len1 > PIPE_SIZE) {
+		len1 = PIPE_SIZE - pos;
+	}
+
+	result = uiomove(p->p_buf + pos, len1, uio);
+	if (result) {
+		return result;
+	}
+	if (len1 < len) {
+		result = uiomove(p->p_buf, len - len1, uio);
+	}
+	return result;
+}
+
+/*
+ * Read: wait until there's something in the pipe, or nobody left to
+ * write any, then take as much as the caller asked for that's there.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t len;
+	int result;
+
+	if (v != &p->p_readvn) {
+		return EBADF;
+	}
+
+	lock_acquire(p->p_lock);
+	while (p->p_count == 0 && p->p_writeopen) {
+		cv_wait(p->p_readcv, p->p_lock);
+	}
+
+	len = uio->uio_resid;
+	if (len > p->p_count) {
+		len = p->p_count;
+	}
+	if (len == 0) {
+		/* end of file */
+		lock_release(p->p_lock);
+		return 0;
+	}
+
+	result = pipe_move(p, p->p_start, len, uio);
+	if (result == 0) {
+		p->p_start = (p->p_start + len) % PIPE_SIZE;
+		p->p_count -= len;
+		cv_broadcast(p->p_writecv, p->p_lock);
+		pollq_wakeup(&p->p_pollq);
+	}
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * Write: put in as much as fits, waiting for readers to make room,
+ * until it's all gone. A write of at most PIPE_BUF bytes waits for
+ * room for all of it so it goes in all at once.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t total, len, need, space;
+	int result = 0;
+
+	if (v != &p->p_writevn) {
+		return EBADF;
+	}
+
+	total = uio->uio_resid;
+	need = (total <= PIPE_BUF) ? total : 1;
+
+	lock_acquire(p->p_lock);
+	while (uio->uio_resid > 0) {
+		if (!p->p_readopen) {
+			/* report a partial write if there was one */
+			if (uio->uio_resid == total) {
+				result = EPIPE;
+			}
+			break;
+		}
+
+		space = PIPE_SIZE - p->p_count;
+		if (space < need) {
+			cv_wait(p->p_writecv, p->p_lock);
+			continue;
+		}
+
+		len = uio->uio_resid;
+		if (len > space) {
+			len = space;
+		}
+		result = pipe_move(p, p->p_start + p->p_count, len, uio);
+		if (result) {
+			break;
+		}
+		p->p_count += len;
+		cv_broadcast(p->p_readcv, p->p_lock);
+		pollq_wakeup(&p->p_pollq);
+	}
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * Stat: a pipe's size is what's waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	lock_acquire(p->p_lock);
+	statbuf->st_size = p->p_count;
+	lock_release(p->p_lock);
+
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_BUF;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+/*
+ * Pipes can't seek.
+ */
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+/*
+ * Poll: the read end is readable if there's data or no writers left
+ * (end of file), and reports POLLHUP once the writers are gone. The
+ * write end is writable if a PIPE_BUF-sized write would go straight
+ * in, and reports POLLERR once the readers are gone.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, int *revents, struct pollwait *pw)
+{
+	struct pipe *p = v->vn_data;
+
+	*revents = 0;
+
+	lock_acquire(p->p_lock);
+	if (v == &p->p_readvn) {
+		if (p->p_count > 0 || !p->p_writeopen) {
+			*revents |= events & POLLIN;
+		}
+		if (!p->p_writeopen) {
+			*revents |= POLLHUP;
+		}
+	}
+	else {
+		if (!p->p_readopen) {
+			*revents |= POLLERR;
+		}
+		else if (PIPE_SIZE - p->p_count >= PIPE_BUF) {
+			*revents |= events & POLLOUT;
+		}
+	}
+	if (pw != NULL) {
+		poll_register(pw, &p->p_pollq);
+	}
+	lock_release(p->p_lock);
+	return 0;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * Operations that are meaningless on pipes.
+ */
+
+static
+int
+pipe_notsupp(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_io_notsupp(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *v, char *pathname, struct vnode **result)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *v, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+/*
+ * Function table for pipe vnodes. Both ends share it.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_io_notsupp,	/* readlink */
+	pipe_io_notsupp,	/* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_poll,
+	pipe_fsync,
+	pipe_notsupp,		/* mmap */
+	pipe_truncate,
+	pipe_io_notsupp,	/* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,		/* remove */
+	pipe_nameop,		/* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+/*
+ * Create a pipe. The two ends come back already open, as if from
+ * vfs_open, so vfs_close is how to get rid of them.
+ */
+int
+pipe_create(struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(struct pipe));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+
+	p->p_buf = kmalloc(PIPE_SIZE);
+	if (p->p_buf == NULL) {
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_lock = lock_create("pipe");
+	if (p->p_lock == NULL) {
+		kfree(p->p_buf);
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_readcv = cv_create("pipe read");
+	if (p->p_readcv == NULL) {
+		lock_destroy(p->p_lock);
+		kfree(p->p_buf);
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_writecv = cv_create("pipe write");
+	if (p->p_writecv == NULL) {
+		cv_destroy(p->p_readcv);
+		lock_destroy(p->p_lock);
+		kfree(p->p_buf);
+		kfree(p);
+		return ENOMEM;
+	}
+
+	pollq_init(&p->p_pollq);
+	p->p_start = 0;
+	p->p_count = 0;
+	p->p_readopen = true;
+	p->p_writeopen = true;
+	p->p_nvnodes = 2;
+
+	result = VOP_INIT(&p->p_readvn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		pipe_destroy(p);
+		return result;
+	}
+	result = VOP_INIT(&p->p_writevn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		VOP_CLEANUP(&p->p_readvn);
+		pipe_destroy(p);
+		return result;
+	}
+
+	VOP_INCOPEN(&p->p_readvn);
+	VOP_INCOPEN(&p->p_writevn);
+
+	*readend = &p->p_readvn;
+	*writeend = &p->p_writevn;
+	return 0;
+}
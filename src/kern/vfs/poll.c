@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Wait queues for poll(). See poll.h.
+ *
+ * A pollwait has one pollent per object it might be hung on, allocated
+ * up front, so registering never allocates and can't fail. Each pollent
+ * is on at most one pollq's list, protected by that pollq's spinlock.
+ *
+ * The wakeup side sets pw_woken and then wakes the wchan; the sleeping
+ * side checks pw_woken holding the wchan lock before it sleeps. Either
+ * the sleeper sees the flag, or it's already asleep when the wakeup
+ * comes.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <poll.h>
+
+struct pollent {
+	struct pollwait *pe_pw;		/* who's waiting */
+	struct pollq *pe_q;		/* what it's hung on */
+	struct pollent *pe_next;	/* rest of pe_q's list */
+	struct pollent **pe_prevp;	/* what points to us */
+};
+
+struct pollwait {
+	struct wchan *pw_wchan;		/* where the poller sleeps */
+	volatile bool pw_woken;		/* something may have changed */
+	unsigned pw_nents;		/* entries in use */
+	unsigned pw_maxents;		/* entries allocated */
+	struct pollent *pw_ents;
+};
+
+////////////////////////////////////////////////////////////
+// pollq
+
+void
+pollq_init(struct pollq *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_waiters = NULL;
+}
+
+void
+pollq_cleanup(struct pollq *pq)
+{
+	KASSERT(pq->pq_waiters == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+/*
+ * Wake up everyone polling this object.
+ */
+void
+pollq_wakeup(struct pollq *pq)
+{
+	struct pollent *pe;
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pe = pq->pq_waiters; pe != NULL; pe = pe->pe_next) {
+		pe->pe_pw->pw_woken = true;
+		wchan_wakeall(pe->pe_pw->pw_wchan);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+/*
+ * Hang PW on PQ, so it's woken by the next pollq_wakeup.
+ */
+void
+poll_register(struct pollwait *pw, struct pollq *pq)
+{
+	struct pollent *pe;
+
+	KASSERT(pw->pw_nents < pw->pw_maxents);
+	pe = &pw->pw_ents[pw->pw_nents++];
+	pe->pe_pw = pw;
+	pe->pe_q = pq;
+
+	spinlock_acquire(&pq->pq_lock);
+	pe->pe_next = pq->pq_waiters;
+	pe->pe_prevp = &pq->pq_waiters;
+	if (pe->pe_next != NULL) {
+		pe->pe_next->pe_prevp = &pe->pe_next;
+	}
+	pq->pq_waiters = pe;
+	spinlock_release(&pq->pq_lock);
+}
+
+////////////////////////////////////////////////////////////
+// pollwait
+
+struct pollwait *
+pollwait_create(unsigned maxents)
+{
+	struct pollwait *pw;
+
+	pw = kmalloc(sizeof(struct pollwait));
+	if (pw == NULL) {
+		return NULL;
+	}
+	pw->pw_ents = NULL;
+	if (maxents > 0) {
+		pw->pw_ents = kmalloc(maxents * sizeof(struct pollent));
+		if (pw->pw_ents == NULL) {
+			kfree(pw);
+			return NULL;
+		}
+	}
+	pw->pw_wchan = wchan_create("poll");
+	if (pw->pw_wchan == NULL) {
+		kfree(pw->pw_ents);
+		kfree(pw);
+		return NULL;
+	}
+	pw->pw_woken = false;
+	pw->pw_nents = 0;
+	pw->pw_maxents = maxents;
+	return pw;
+}
+
+void
+pollwait_destroy(struct pollwait *pw)
+{
+	pollwait_clear(pw);
+	wchan_destroy(pw->pw_wchan);
+	kfree(pw->pw_ents);
+	kfree(pw);
+}
+
+/*
+ * Sleep until one of the pollqs PW is hung on is woken, or TICKS
+ * hardclocks pass. Returns 0 or ETIMEDOUT. Doesn't sleep at all if a
+ * wakeup already came since the last pollwait_clear.
+ */
+int
+pollwait_sleep(struct pollwait *pw, int ticks)
+{
+	wchan_lock(pw->pw_wchan);
+	if (pw->pw_woken) {
+		wchan_unlock(pw->pw_wchan);
+		return 0;
+	}
+	if (ticks < 0) {
+		wchan_sleep(pw->pw_wchan);
+		return 0;
+	}
+	return wchan_sleep_timeout(pw->pw_wchan, ticks);
+}
+
+/*
+ * Take PW off every pollq it's hung on, and forget any wakeups.
+ */
+void
+pollwait_clear(struct pollwait *pw)
+{
+	struct pollent *pe;
+	unsigned i;
+
+	for (i=0; i<pw->pw_nents; i++) {
+		pe = &pw->pw_ents[i];
+		spinlock_acquire(&pe->pe_q->pq_lock);
+		if (pe->pe_next != NULL) {
+			pe->pe_next->pe_prevp = pe->pe_prevp;
+		}
+		*pe->pe_prevp = pe->pe_next;
+		spinlock_release(&pe->pe_q->pq_lock);
+	}
+	pw->pw_nents = 0;
+	pw->pw_woken = false;
+}
@@ -36,6 +36,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <limits.h>
 #include <lib.h>
 #include <array.h>
 #include <synch.h>
@@ -60,6 +61,10 @@
  * kd_fs      - Filesystem object mounted on, or associated with, this
  *              device. NULL if there is no filesystem. 
  *
+ * kd_volname - Copy of the volume name of kd_fs, so it can be looked
+ *              up without calling into the filesystem. Empty if there
+ *              is no filesystem or it has no volume name.
+ *
  * A filesystem can be associated with a device without having been
  * mounted if the device was created that way. In this case,
  * kd_rawname is NULL (prohibiting mount/unmount), and, as there is
@@ -80,6 +85,7 @@ struct knowndev {
 	struct device *kd_device;
 	struct vnode *kd_vnode;
 	struct fs *kd_fs;
+	char kd_volname[NAME_MAX+1];
 };
 
 DECLARRAY(knowndev);
@@ -87,6 +93,19 @@ DEFARRAY(knowndev, /*no inline*/);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * Reader-writer lock for knowndevs and the kd_fs and kd_volname fields
+ * in it.
+ *
+ * Anything that changes the table also holds vfs_biglock, so code
+ * already holding the biglock may read the table without this lock;
+ * lookups that don't otherwise need the biglock take it for reading
+ * and so don't serialize with each other. If both are needed, get
+ * vfs_biglock first; in particular, don't call into a filesystem
+ * with only this lock held, as it may take the biglock.
+ */
+static struct rwlock *knowndevs_lock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -103,6 +122,11 @@ vfs_bootstrap(void)
 		panic("vfs: Could not create knowndevs array\n");
 	}
 
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
+
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
 		panic("vfs: Could not create vfs big lock\n");
@@ -170,84 +194,99 @@ vfs_sync(void)
 }
 
 /*
- * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
- * back an appropriate vnode.
+ * Find the device DEVNAME names: by its name, its raw name, or the
+ * volume name of the filesystem mounted on it. Caller must hold
+ * knowndevs_lock or vfs_biglock.
  */
-int
-vfs_getroot(const char *devname, struct vnode **result)
+static
+struct knowndev *
+findname(const char *devname)
 {
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
 
-		/*
-		 * If this device has a mounted filesystem, and
-		 * DEVNAME names either the filesystem or the device,
-		 * return the root of the filesystem.
-		 *
-		 * If it has no mounted filesystem, it's mountable,
-		 * and DEVNAME names the device, return ENXIO.
-		 */
-
-		if (kd->kd_fs!=NULL) {
-			const char *volname;
-			volname = FSOP_GETVOLNAME(kd->kd_fs);
-
-			if (!strcmp(kd->kd_name, devname) ||
-			    (volname!=NULL && !strcmp(volname, devname))) {
-				*result = FSOP_GETROOT(kd->kd_fs);
-				return 0;
-			}
+		if (kd->kd_fs!=NULL && kd->kd_volname[0]!=0 &&
+		    !strcmp(kd->kd_volname, devname)) {
+			return kd;
 		}
-		else {
-			if (kd->kd_rawname!=NULL &&
-			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
-			}
+		if (!strcmp(kd->kd_name, devname) ||
+		    (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname))) {
+			return kd;
 		}
+	}
+	return NULL;
+}
 
-		/*
-		 * If DEVNAME names the device, and we get here, it
-		 * must have no fs and not be mountable. In this case,
-		 * we return the device itself.
-		 */
-		if (!strcmp(kd->kd_name, devname)) {
-			KASSERT(kd->kd_fs==NULL);
-			KASSERT(kd->kd_rawname==NULL);
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*result = kd->kd_vnode;
-			return 0;
-		}
+/*
+ * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
+ * back an appropriate vnode.
+ *
+ * This needs only knowndevs_lock, except to get the root of a
+ * mounted filesystem, which needs vfs_biglock. That comes before
+ * knowndevs_lock, so let go of the latter, get the former, and check
+ * the device is still mounted and still goes by DEVNAME. (Entries in
+ * knowndevs are never removed.)
+ */
+int
+vfs_getroot(const char *devname, struct vnode **result)
+{
+	struct knowndev *kd;
 
-		/*
-		 * If the device has a rawname and DEVNAME names that,
-		 * return the device itself.
-		 */
-		if (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname)) {
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*result = kd->kd_vnode;
-			return 0;
-		}
+ again:
+	rwlock_acquire_read(knowndevs_lock);
 
-		/*
-		 * If none of the above tests matched, we didn't name
-		 * any of the names of this device, so go on to the
-		 * next one. 
-		 */
+	kd = findname(devname);
+	if (kd == NULL) {
+		rwlock_release_read(knowndevs_lock);
+		return ENODEV;
 	}
 
 	/*
-	 * If we got here, the device specified by devname doesn't exist.
+	 * If DEVNAME names the raw device, or a device with no
+	 * filesystem that isn't mountable, return the device itself.
+	 *
+	 * If it names a mountable device with no mounted filesystem,
+	 * return ENXIO.
 	 */
+	if (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname)) {
+		KASSERT(kd->kd_device != NULL);
+		VOP_INCREF(kd->kd_vnode);
+		*result = kd->kd_vnode;
+		rwlock_release_read(knowndevs_lock);
+		return 0;
+	}
+	if (kd->kd_fs==NULL) {
+		if (kd->kd_rawname!=NULL) {
+			rwlock_release_read(knowndevs_lock);
+			return ENXIO;
+		}
+		KASSERT(kd->kd_device != NULL);
+		VOP_INCREF(kd->kd_vnode);
+		*result = kd->kd_vnode;
+		rwlock_release_read(knowndevs_lock);
+		return 0;
+	}
+
+	rwlock_release_read(knowndevs_lock);
 
-	return ENODEV;
+	/*
+	 * DEVNAME names either the filesystem or the device it's
+	 * mounted on; return the root of the filesystem.
+	 */
+	vfs_biglock_acquire();
+	if (findname(devname) != kd || kd->kd_fs == NULL) {
+		/* unmounted or remounted meanwhile */
+		vfs_biglock_release();
+		goto again;
+	}
+	*result = FSOP_GETROOT(kd->kd_fs);
+	vfs_biglock_release();
+
+	return 0;
 }
 
 /*
@@ -257,11 +296,14 @@ const char *
 vfs_getdevname(struct fs *fs)
 {
 	struct knowndev *kd;
+	const char *name;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
+	name = NULL;
+
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -274,11 +316,14 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
 
-	return NULL;
+	rwlock_release_read(knowndevs_lock);
+
+	return name;
 }
 
 /*
@@ -406,9 +451,14 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	kd->kd_device = dev;
 	kd->kd_vnode = vnode;
 	kd->kd_fs = fs;
+	kd->kd_volname[0] = 0;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
+		if (volname!=NULL) {
+			snprintf(kd->kd_volname, sizeof(kd->kd_volname),
+				 "%s", volname);
+		}
 	}
 
 	if (badnames(name, rawname, volname)) {
@@ -416,7 +466,9 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		return EEXIST;
 	}
 
+	rwlock_acquire_write(knowndevs_lock);
 	result = knowndevarray_add(knowndevs, kd, &index);
+	rwlock_release_write(knowndevs_lock);
 
 	if (result == 0 && dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
@@ -470,7 +522,7 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_biglock, which keeps the table from changing.
  */
 static
 int
@@ -537,9 +589,14 @@ vfs_mount(const char *devname, void *data,
 
 	KASSERT(fs != NULL);
 
+	volname = FSOP_GETVOLNAME(fs);
+
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = fs;
+	snprintf(kd->kd_volname, sizeof(kd->kd_volname), "%s",
+		 volname ? volname : "");
+	rwlock_release_write(knowndevs_lock);
 
-	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
 		volname ? volname : kd->kd_name, kd->kd_name);
 
@@ -584,7 +641,10 @@ vfs_unmount(const char *devname)
 	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
 	/* now drop the filesystem */
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = NULL;
+	kd->kd_volname[0] = 0;
+	rwlock_release_write(knowndevs_lock);
 
 	KASSERT(result==0);
 
@@ -647,7 +707,10 @@ vfs_unmountall(void)
 		}
 
 		/* now drop the filesystem */
+		rwlock_acquire_write(knowndevs_lock);
 		dev->kd_fs = NULL;
+		dev->kd_volname[0] = 0;
+		rwlock_release_write(knowndevs_lock);
 	}
 
 	vfs_biglock_release();
@@ -123,6 +123,10 @@ vfs_clearbootfs(void)
 /*
  * Common code to pull the device name, if any, off the front of a
  * path and choose the vnode to begin the name lookup relative to.
+ *
+ * Called without vfs_biglock, so that looking up a bare device name
+ * (con:, null:, lhd0raw:) doesn't need it at all; takes it only for
+ * the parts that do.
  */
 
 static
@@ -133,8 +137,6 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	struct vnode *vn;
 	int result;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/*
 	 * Locate the first colon or slash.
 	 */
@@ -188,11 +190,14 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	KASSERT(colon==0 || slash==0);
 
 	if (path[0]=='/') {
+		vfs_biglock_acquire();
 		if (bootfs_vnode==NULL) {
+			vfs_biglock_release();
 			return ENOENT;
 		}
 		VOP_INCREF(bootfs_vnode);
 		*startvn = bootfs_vnode;
+		vfs_biglock_release();
 	}
 	else {
 		KASSERT(path[0]==':');
@@ -208,9 +213,10 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 		 */
 		KASSERT(vn->vn_fs!=NULL);
 
+		vfs_biglock_acquire();
 		*startvn = FSOP_GETROOT(vn->vn_fs);
-
 		VOP_DECREF(vn);
+		vfs_biglock_release();
 	}
 
 	while (path[1]=='/') {
@@ -235,14 +241,13 @@ vfs_lookparent(char *path, struct vnode **retval,
 	struct vnode *startvn;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
+	vfs_biglock_acquire();
+
 	if (strlen(path)==0) {
 		/*
 		 * It does not make sense to use just a device name in
@@ -267,20 +272,17 @@ vfs_lookup(char *path, struct vnode **retval)
 	struct vnode *startvn;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
+	vfs_biglock_acquire();
 	result = VOP_LOOKUP(startvn, path, retval);
 
 	VOP_DECREF(startvn);
@@ -32,6 +32,7 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
 #include <lib.h>
 #include <synch.h>
 #include <vfs.h>
@@ -73,6 +74,21 @@ vnode_cleanup(struct vnode *vn)
 	vn->vn_data = NULL;
 }
 
+/*
+ * Poll an object that never makes anyone wait: whatever was asked
+ * about is ready, now and forever, so there's nothing to register
+ * for.
+ */
+int
+vnode_poll_ready(struct vnode *v, int events, int *revents,
+		 struct pollwait *pw)
+{
+	(void)v;
+	(void)pw;
+	*revents = events & (POLLIN | POLLOUT);
+	return 0;
+}
+
 
 /*
  * Increment refcount.
@@ -356,15 +356,14 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 //	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+static int vm_fault_locked(struct addrspace *as, int faulttype,
+			   vaddr_t faultaddress);
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	struct addrspace *as;
-	vaddr_t * page_entry;
-	paddr_t paddr;
-	uint32_t ehi, elo;
-	int spl;
-	uint32_t index_two;
+	int result;
 
 	as = curthread->t_addrspace;
 	if (as == NULL) {
@@ -379,6 +378,23 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	 
 	faultaddress &= PAGE_FRAME;
 
+	// threads sharing the address space may fault at the same time
+	spinlock_acquire(&as->as_lock);
+	result = vm_fault_locked(as, faulttype, faultaddress);
+	spinlock_release(&as->as_lock);
+	return result;
+}
+
+static
+int
+vm_fault_locked(struct addrspace *as, int faulttype, vaddr_t faultaddress)
+{
+	vaddr_t * page_entry;
+	paddr_t paddr;
+	uint32_t ehi, elo;
+	int spl;
+	uint32_t index_two;
+
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
 	         page_entry = page_walk(as, faultaddress,0);
@@ -462,10 +478,20 @@ as_create(void)
 	if((void *)as->page_table_addr == NULL){
 		return NULL;
 	}
+	spinlock_init(&as->as_lock);
+	as->as_refcount = 1;
 
 	return as;
 }
 
+void
+as_incref(struct addrspace *as)
+{
+	spinlock_acquire(&as->as_lock);
+	as->as_refcount++;
+	spinlock_release(&as->as_lock);
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -523,7 +549,18 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	
+	unsigned refs;
+
+	// other threads may still be using it
+	spinlock_acquire(&as->as_lock);
+	KASSERT(as->as_refcount > 0);
+	refs = --as->as_refcount;
+	spinlock_release(&as->as_lock);
+	if (refs > 0) {
+		return;
+	}
+	spinlock_cleanup(&as->as_lock);
+
 	// free pages and page table
 	vaddr_t* dir_one = (vaddr_t *)as->page_table_addr;
 
@@ -36,6 +36,9 @@
  * Usage: cat [files]
  */
 
+/* how much to ask for per copy_file_range call */
+#define COPY_MAX (1024*1024)
+
 
 
 /* Print a file that's already been opened. */
@@ -43,34 +46,20 @@ static
 void
 docat(const char *name, int fd)
 {
-	char buf[1024];
-	int len, wr, wrtot;
+	int len;
 
 	/*
+	 * Let the kernel move the data straight to stdout.
 	 * As long as we get more than zero bytes, we haven't hit EOF.
-	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * Zero means EOF. Less than zero means an error occurred, on
+	 * one side or the other.
 	 */
-	while ((len = read(fd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(STDOUT_FILENO, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "stdout");
-			}
-			wrtot += wr;
-		}
+	while ((len = copy_file_range(fd, NULL, STDOUT_FILENO, NULL,
+				      COPY_MAX))>0) {
+		/* nothing */
 	}
-	/*
-	 * If we got a read error, print it and exit.
-	 */
 	if (len<0) {
-		err(1, "%s", name);
+		err(1, "%s to stdout", name);
 	}
 }
 
@@ -92,17 +92,10 @@ int
 isdir(const char *path)
 {
 	struct stat buf;
-	int fd;
 
-	/* Assume stat() may not be implemented; use fstat */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
+	if (stat(path, &buf)<0) {
 		err(1, "%s", path);
 	}
-	if (fstat(fd, &buf)<0) {
-		err(1, "%s: fstat", path);
-	}
-	close(fd);
 
 	return S_ISDIR(buf.st_mode);
 }
@@ -139,16 +132,9 @@ print(const char *path)
 	int typech;
 
 	if (lopt || sopt) {
-		int fd;
-
-		fd = open(path, O_RDONLY);
-		if (fd<0) {
+		if (stat(path, &statbuf)<0) {
 			err(1, "%s", path);
 		}
-		if (fstat(fd, &statbuf)<0) {
-			err(1, "%s: fstat", path);
-		}
-		close(fd);
 	}
 
 	file = basename(path);
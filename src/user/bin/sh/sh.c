@@ -43,6 +43,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <poll.h>
 #include <errno.h>
 #include <err.h>
 
@@ -71,21 +72,21 @@ static pid_t bgpids[MAXBG];
 
 /*
  * can_bg
- * just checks for an open slot.
+ * just checks for N open slots, one for each process in the job.
  */
 static
 int
-can_bg(void)
+can_bg(int n)
 {
 	int i;
 	
-	for (i = 0; i < MAXBG; i++) {
+	for (i = 0; i < MAXBG && n > 0; i++) {
 		if (bgpids[i] == 0) {
-			return 1;
+			n--;
 		}
 	}
 	
-	return 0;
+	return n == 0;
 }
 
 /* 
@@ -151,44 +152,110 @@ dowait(pid_t pid)
 	}
 }
 
-#ifdef WNOHANG
 /*
- * dowaitpoll
- * like dowait, but uses WNOHANG. returns true if we got something.
+ * forget_bg
+ * clears a pid out of the background array, if it's there.
+ */
+static
+void
+forget_bg(pid_t pid)
+{
+	int i;
+	for (i = 0; i < MAXBG; i++) {
+		if (bgpids[i] == pid) {
+			bgpids[i] = 0;
+		}
+	}
+}
+
+/*
+ * have_bg
+ * returns true if any background job hasn't been waited for.
  */
 static
 int
-dowaitpoll(pid_t pid)
+have_bg(void)
+{
+	int i;
+	for (i = 0; i < MAXBG; i++) {
+		if (bgpids[i] != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * dowaitany
+ * waits for whichever child exits next and reports it. returns the
+ * pid, or 0 if there wasn't one (or, with WNOHANG, none had exited).
+ */
+static
+pid_t
+dowaitany(int flags)
 {
 	int status;
-	pid_t result;
-	result = waitpid(pid, &status, WNOHANG);
-	if (result<0) {
-		warn("pid %d", pid);
+	pid_t pid;
+
+	pid = waitpid(WAIT_ANY, &status, flags);
+	if (pid < 0) {
+		if (errno != ECHILD) {
+			warn("waitpid");
+		}
+		return 0;
 	}
-	else if (result!=0) {
+	if (pid > 0) {
 		printf("pid %d: ", pid);
 		printstatus(status);
 		printf("\n");
-		return 1;
+		forget_bg(pid);
 	}
-	return 0;
+	return pid;
 }
 
+#ifdef WNOHANG
 /*
  * waitpoll
- * poll all background jobs for having exited.
+ * collect any background jobs that have exited. one waitpid per job
+ * that's finished, rather than one per job we're remembering. returns
+ * how many there were.
  */
 static
-void
+int
 waitpoll(void)
 {
-	int i;
-	for (i=0; i < MAXBG; i++) {
-		if (bgpids[i] != 0) {
-			if (dowaitpoll(bgpids[i])) {
-				bgpids[i] = 0;
-			}
+	int n = 0;
+
+	while (dowaitany(WNOHANG) > 0) {
+		n++;
+	}
+	return n;
+}
+
+/* how often to look for finished jobs while waiting for input */
+#define BGPOLL_MS 500
+
+/*
+ * waitinput
+ * while there are background jobs and nothing has been typed, wait for
+ * input with poll, collecting jobs as they finish, so they're reported
+ * when they're done instead of at the next command.
+ */
+static
+void
+waitinput(void)
+{
+	struct pollfd pfd;
+
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	while (have_bg()) {
+		if (poll(&pfd, 1, BGPOLL_MS) != 0) {
+			/* input, or poll doesn't work; go read */
+			return;
+		}
+		if (waitpoll() > 0) {
+			printf("OS/161$ ");
 		}
 	}
 }
@@ -210,18 +277,16 @@ cmd_wait(int ac, char *av[])
 	if (ac == 2) {
 		pid = atoi(av[1]);
 		dowait(pid);
-		for (i = 0; i < MAXBG; i++) {
-			if (bgpids[i]==pid) {
-				bgpids[i] = 0;
-			}
-		}
+		forget_bg(pid);
 		return 0;
 	}
 	else if (ac == 1) {
-		for (i=0; i < MAXBG; i++) {
-			if (bgpids[i] != 0) {
-				dowait(bgpids[i]);
-				bgpids[i] = 0;
+		while (have_bg()) {
+			if (dowaitany(0) == 0) {
+				/* no children left; nothing more to wait for */
+				for (i = 0; i < MAXBG; i++) {
+					bgpids[i] = 0;
+				}
 			}
 		}
 		return 0;
@@ -292,6 +357,194 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * startcmd
+ * starts a single program running, and returns its pid, or -1 if it
+ * couldn't be run.
+ */
+static
+pid_t
+startcmd(char **args)
+{
+	pid_t pid;
+
+#ifdef HOST
+	pid = fork();
+	switch (pid) {
+		case -1:
+			/* error */
+			warn("fork");
+			return -1;
+		case 0:
+			/* child */
+			execv(args[0], args);
+			warn("%s", args[0]);
+			/*
+			 * Use _exit() instead of exit() in the child
+			 * process to avoid calling atexit() functions,
+			 * which would cause hostcompat (if present) to
+			 * reset the tty state and mess up our input
+			 * handling.
+			 */
+			_exit(1);
+		default:
+			break;
+	}
+#else
+	/*
+	 * spawn loads the program straight into the new process, so we
+	 * don't copy our whole address space just to throw it away in
+	 * execv. If the program can't be run, we find out here rather
+	 * than from the child's exit status.
+	 */
+	pid = spawn(args[0], args);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return -1;
+	}
+#endif
+
+	return pid;
+}
+
+/* most commands in one pipeline */
+#define MAXSTAGES 16
+
+/*
+ * startstage
+ * starts one command of a pipeline, with INFD as its stdin and OUTFD as
+ * its stdout. CLOSEFD, if not -1, is the read end of the pipe OUTFD
+ * writes to, which the command mustn't hold open.
+ *
+ * this uses fork rather than spawn, because a spawned process gets all
+ * our file handles, and a writer holding its own pipe's read end would
+ * never see EPIPE. the forked child can close what it shouldn't have
+ * before it execs.
+ */
+static
+pid_t
+startstage(char **args, int infd, int outfd, int closefd)
+{
+	pid_t pid;
+
+	pid = fork();
+	switch (pid) {
+		case -1:
+			warn("fork");
+			return -1;
+		case 0:
+			/* child */
+			if (infd != STDIN_FILENO) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (outfd != STDOUT_FILENO) {
+				dup2(outfd, STDOUT_FILENO);
+				close(outfd);
+			}
+			if (closefd >= 0) {
+				close(closefd);
+			}
+			execv(args[0], args);
+			warn("%s", args[0]);
+			/* _exit, not exit; see startcmd */
+			_exit(1);
+		default:
+			break;
+	}
+	return pid;
+}
+
+/*
+ * runpipeline
+ * starts the NSTAGES commands in STAGES, each one's stdout connected to
+ * the next one's stdin with a pipe, and puts their pids in PIDS.
+ * returns how many were started, which is less than NSTAGES if they
+ * couldn't all be. whatever was started runs to completion either way,
+ * and the caller has to wait for it.
+ */
+static
+int
+runpipeline(char **stages[], int nstages, pid_t pids[])
+{
+	int i, infd, outfd, closefd;
+	int fds[2];
+	pid_t pid;
+
+	infd = STDIN_FILENO;
+	for (i=0; i<nstages; i++) {
+		if (i < nstages-1) {
+			if (pipe(fds) < 0) {
+				warn("pipe");
+				break;
+			}
+			outfd = fds[1];
+			closefd = fds[0];
+		}
+		else {
+			outfd = STDOUT_FILENO;
+			closefd = -1;
+		}
+
+		pid = startstage(stages[i], infd, outfd, closefd);
+
+		/* the child has these now; we mustn't keep them */
+		if (infd != STDIN_FILENO) {
+			close(infd);
+		}
+		if (outfd != STDOUT_FILENO) {
+			close(outfd);
+		}
+		infd = (closefd >= 0) ? closefd : STDIN_FILENO;
+
+		if (pid < 0) {
+			break;
+		}
+		pids[i] = pid;
+	}
+
+	if (infd != STDIN_FILENO) {
+		close(infd);
+	}
+
+	return i;
+}
+
+/*
+ * splitpipeline
+ * breaks ARGS up at each "|", filling in STAGES with the start of each
+ * command. returns the number of commands, or -1 if one was empty or
+ * there were too many.
+ */
+static
+int
+splitpipeline(char **args, int nargs, char **stages[])
+{
+	int i, nstages;
+
+	nstages = 0;
+	stages[nstages++] = args;
+	for (i=0; i<nargs; i++) {
+		if (strcmp(args[i], "|") != 0) {
+			continue;
+		}
+		args[i] = NULL;
+		if (nstages >= MAXSTAGES) {
+			printf("Too many commands in pipeline\n");
+			return -1;
+		}
+		stages[nstages++] = &args[i+1];
+	}
+
+	for (i=0; i<nstages; i++) {
+		if (stages[i][0] == NULL) {
+			printf("Missing command in pipeline\n");
+			return -1;
+		}
+	}
+	return nstages;
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
@@ -304,7 +557,9 @@ int
 docommand(char *buf)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **stages[MAXSTAGES];
+	pid_t pids[MAXSTAGES];
+	int nargs, nstages, nstarted, i, junk;
 	char *s;
 	pid_t pid;
 	int status;
@@ -339,47 +594,52 @@ docommand(char *buf)
 
 	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
 		/* background */
-		if (!can_bg()) {
-			printf("%s: Too many background jobs; wait for "
-			       "some to finish before starting more\n",
-			       args[0]);
-			return -1;
-		}
 		nargs--;
 		args[nargs] = NULL;
 		bg = 1;
 	}
 
+	nstages = splitpipeline(args, nargs, stages);
+	if (nstages < 0) {
+		return _MKWAIT_EXIT(1);
+	}
+
+	/* every process in a background pipeline gets remembered */
+	if (bg && !can_bg(nstages)) {
+		printf("%s: Too many background jobs; wait for "
+		       "some to finish before starting more\n",
+		       args[0]);
+		return -1;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+	if (nstages > 1) {
+		nstarted = runpipeline(stages, nstages, pids);
+		if (nstarted < nstages) {
+			/* collect the stages that did start */
+			for (i=0; i<nstarted; i++) {
+				waitpid(pids[i], &junk, 0);
+			}
+			return _MKWAIT_EXIT(1);
+		}
+	}
+	else {
+		pids[0] = startcmd(args);
+		if (pids[0] < 0) {
+			return _MKWAIT_EXIT(1);
+		}
 	}
+	pid = pids[nstages-1];
 
 	/* parent */
 	if (bg) {
 		/* background this command */
-		remember_bg(pid);
+		for (i=0; i<nstages; i++) {
+			remember_bg(pids[i]);
+		}
 		printf("[%d] %s ... &\n", pid, args[0]);
 		return 0;
 	}
@@ -389,6 +649,15 @@ docommand(char *buf)
 		status = -1;
 	}
 
+	/*
+	 * collect the rest of the pipeline by pid, so a background job
+	 * that happens to finish now isn't reaped in its place; the
+	 * status is the last one's.
+	 */
+	for (i=0; i<nstages-1; i++) {
+		waitpid(pids[i], &junk, 0);
+	}
+
 	if (timing) {
 		__time(&endsecs, &endnsecs);
 		if (endnsecs < startnsecs) {
@@ -426,6 +695,11 @@ getcmd(char *buf, size_t len)
 	 */
 
 	while (!done) {
+#ifdef WNOHANG
+		if (pos == 0) {
+			waitinput();
+		}
+#endif
 		ch = getchar();
 		if ((ch == '\b' || ch == 127) && pos > 0) {
 			putchar('\b');
@@ -118,6 +118,7 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t spawn(const char *prog, char *const *args);
 int waitpid(pid_t pid, int *returncode, int flags);
 /* 
  * Open actually takes either two or three args: the optional third
@@ -137,6 +138,10 @@ int rmdir(const char *dirname);
 int getpid(void);
 int ioctl(int filehandle, int code, void *buf);
 off_t lseek(int filehandle, off_t pos, int code);
+int pread(int filehandle, void *buf, size_t size, off_t pos);
+int pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+int copy_file_range(int infile, off_t *inpos, int outfile, off_t *outpos,
+		    size_t len);
 int fsync(int filehandle);
 int ftruncate(int filehandle, off_t size);
 int remove(const char *filename);
@@ -153,6 +158,13 @@ int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+int futex_wait(volatile int *addr, int expected);
+int futex_wake(volatile int *addr, int n);
+int aio_read(int filehandle, void *buf, size_t size, off_t pos);
+int aio_write(int filehandle, const void *buf, size_t size, off_t pos);
+int aio_wait(int id);
+pid_t __threadfork(void (*entry)(void *), void *arg, void *stack);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
@@ -164,4 +176,9 @@ int __getcwd(char *buf, size_t buflen);
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
 
+/* User threads (calls __threadfork, waitpid, _exit) */
+pid_t threadfork(void (*func)(void *), void *arg);
+int threadjoin(pid_t tid, int *status);
+__DEAD void threadexit(int code);
+
 #endif /* _UNISTD_H_ */
@@ -28,15 +28,28 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 /*
  * C standard I/O function - print a string and a newline.
+ *
+ * The string and the newline go out together in one writev.
  */
 
 int
 puts(const char *s)
 {
-	__puts(s);
-	putchar('\n');
+	struct iovec iov[2];
+
+	iov[0].iov_base = (void *)s;
+	iov[0].iov_len = strlen(s);
+	iov[1].iov_base = (void *)"\n";
+	iov[1].iov_len = 1;
+
+	if (writev(STDOUT_FILENO, iov, 2) < 0) {
+		return EOF;
+	}
 	return 0;
 }
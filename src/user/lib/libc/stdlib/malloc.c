@@ -40,6 +40,7 @@
 #include <unistd.h>
 #include <err.h>
 #include <stdint.h>  // for uintptr_t on non-OS/161 platforms
+#include <synch.h>
 
 #undef MALLOCDEBUG
 
@@ -329,8 +330,9 @@ __malloc_split(struct mheader *mh, size_t size)
 /*
  * malloc itself.
  */
+static
 void *
-malloc(size_t size)
+__malloc(size_t size)
 {
 	struct mheader *mh;
 	uintptr_t i;
@@ -478,8 +480,9 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 /*
  * The actual free() implementation.
  */
+static
 void
-free(void *x)
+__free(void *x)
 {
 	struct mheader *mh, *mhnext, *mhprev;
 
@@ -537,3 +540,31 @@ free(void *x)
 	__malloc_dump();
 #endif
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * The heap is shared by all the threads in the process, so malloc
+ * and free run one at a time. The mutex costs nothing unless two
+ * threads actually collide.
+ */
+static struct mutex __malloc_lock = MUTEX_INITIALIZER;
+
+void *
+malloc(size_t size)
+{
+	void *ret;
+
+	mutex_lock(&__malloc_lock);
+	ret = __malloc(size);
+	mutex_unlock(&__malloc_lock);
+	return ret;
+}
+
+void
+free(void *x)
+{
+	mutex_lock(&__malloc_lock);
+	__free(x);
+	mutex_unlock(&__malloc_lock);
+}
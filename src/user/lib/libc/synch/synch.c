@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <synch.h>
+
+/*
+ * User-level mutexes and condition variables.
+ *
+ * The mutex is the usual three-state futex lock: 0 is free, 1 is held
+ * with nobody waiting, and 2 is held with (possibly) somebody asleep
+ * in the kernel. Taking a free lock and releasing a lock in state 1
+ * are single atomic operations; only state 2 costs a system call.
+ *
+ * The condition variable is a sequence number that every signal
+ * bumps. A waiter samples it before dropping the mutex and sleeps
+ * only if it is still unchanged, so a signal in between isn't lost.
+ * Signals skip the system call entirely if no one is waiting.
+ */
+
+/* In arch/<machine>/atomic-<machine>.S; each returns the old value. */
+int __atomic_cas(volatile int *p, int old, int new);
+int __atomic_swap(volatile int *p, int new);
+int __atomic_add(volatile int *p, int delta);
+
+/*
+ * futex_wait fails with EAGAIN whenever the value has already
+ * changed. That is a normal outcome here, so don't let it leak into
+ * the caller's errno.
+ */
+static
+void
+waitfor(volatile int *addr, int expected)
+{
+	int olderrno = errno;
+
+	futex_wait(addr, expected);
+	errno = olderrno;
+}
+
+void
+mutex_init(struct mutex *m)
+{
+	m->m_state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+	int c;
+
+	c = __atomic_cas(&m->m_state, 0, 1);
+	if (c == 0) {
+		return;
+	}
+
+	/*
+	 * Contended. Mark the lock as having waiters and sleep until
+	 * we find it free. Since we can't tell whether anyone else is
+	 * still waiting, we always take it in state 2; that costs at
+	 * worst one unneeded futex_wake.
+	 */
+	if (c != 2) {
+		c = __atomic_swap(&m->m_state, 2);
+	}
+	while (c != 0) {
+		waitfor(&m->m_state, 2);
+		c = __atomic_swap(&m->m_state, 2);
+	}
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+	if (__atomic_cas(&m->m_state, 0, 1) == 0) {
+		return 0;
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+	if (__atomic_swap(&m->m_state, 0) == 2) {
+		futex_wake(&m->m_state, 1);
+	}
+}
+
+void
+cond_init(struct cond *c)
+{
+	c->c_seq = 0;
+	c->c_waiters = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+	int seq;
+
+	__atomic_add(&c->c_waiters, 1);
+	seq = c->c_seq;
+	mutex_unlock(m);
+
+	waitfor(&c->c_seq, seq);
+
+	__atomic_add(&c->c_waiters, -1);
+
+	/*
+	 * Relock in state 2, as in the contended path of mutex_lock:
+	 * other threads woken by a broadcast may be queued behind us.
+	 */
+	while (__atomic_swap(&m->m_state, 2) != 0) {
+		waitfor(&m->m_state, 2);
+	}
+}
+
+void
+cond_signal(struct cond *c)
+{
+	__atomic_add(&c->c_seq, 1);
+	if (c->c_waiters > 0) {
+		futex_wake(&c->c_seq, 1);
+	}
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+	__atomic_add(&c->c_seq, 1);
+	if (c->c_waiters > 0) {
+		futex_wake(&c->c_seq, c->c_waiters);
+	}
+}
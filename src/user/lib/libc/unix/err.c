@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <err.h>
 #include <errno.h>
 
@@ -45,26 +46,20 @@
 extern char **__argv;
 
 /*
- * Routine to print error message text to stderr.
+ * Longest message we'll format. Longer ones are cut off.
  */
-static
-void
-__senderr(void *junk, const char *data, size_t len)
-{
-	(void)junk;  /* not needed or used */
-
-	write(STDERR_FILENO, data, len);
-}
+#define ERRMSG_MAX 512
 
 /*
- * Shortcut to call __senderr on a null-terminated string.
- * (__senderr is set up to be called by __vprintf.)
+ * Add a null-terminated string to the iovecs for the message.
  */
 static
 void
-__senderrstr(const char *str)
+__adderrstr(struct iovec *iov, int *niov, const char *str)
 {
-	__senderr(NULL, str, strlen(str));
+	iov[*niov].iov_base = (void *)str;
+	iov[*niov].iov_len = strlen(str);
+	(*niov)++;
 }
 
 /*
@@ -76,6 +71,9 @@ __printerr(int use_errno, const char *fmt, va_list ap)
 {
 	const char *errmsg;
 	const char *prog;
+	char msg[ERRMSG_MAX];
+	struct iovec iov[6];
+	int niov = 0;
 
 	/*
 	 * Get the error message for the current errno.
@@ -98,21 +96,25 @@ __printerr(int use_errno, const char *fmt, va_list ap)
 		prog = "(program name unknown)";
 	}
 
-	/* print the program name */
-	__senderrstr(prog);
-	__senderrstr(": ");
-
 	/* process the printf format and args */
-	__vprintf(__senderr, NULL, fmt, ap);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
 
-	/* if we're using errno, print the error string from above. */
+	/*
+	 * Gather the program name, the message, the error string from
+	 * above if we're using errno, and always a newline, and print
+	 * them in one go. This is one system call instead of six, and
+	 * keeps the line in one piece if others are printing too.
+	 */
+	__adderrstr(iov, &niov, prog);
+	__adderrstr(iov, &niov, ": ");
+	__adderrstr(iov, &niov, msg);
 	if (use_errno) {
-		__senderrstr(": ");
-		__senderrstr(errmsg);
+		__adderrstr(iov, &niov, ": ");
+		__adderrstr(iov, &niov, errmsg);
 	}
+	__adderrstr(iov, &niov, "\n");
 
-	/* and always add a newline. */
-	__senderrstr("\n");
+	writev(STDERR_FILENO, iov, niov);
 }
 
 /*
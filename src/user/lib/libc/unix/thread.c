@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <synch.h>
+
+/*
+ * User-level threads. The kernel does the real work in
+ * __threadfork(): each new thread is a kernel thread with its own
+ * pid that shares our address space and open files. All we add here
+ * is allocating and freeing the user stacks.
+ *
+ * Each thread's stack comes from malloc. The thread can't free it
+ * itself, so threadjoin does it; a thread nobody joins keeps its
+ * stack until the process goes away.
+ */
+
+#define THREAD_STACKSIZE	(64*1024)
+
+struct threadinfo {
+	void (*ti_func)(void *);
+	void *ti_arg;
+	void *ti_stack;
+	pid_t ti_tid;
+	struct threadinfo *ti_next;
+};
+
+static struct mutex threads_lock = MUTEX_INITIALIZER;
+static struct threadinfo *threads;
+
+/*
+ * Where new threads start. Returning from the thread function exits
+ * the thread.
+ */
+static
+void
+threadstart(void *vti)
+{
+	struct threadinfo *ti = vti;
+
+	ti->ti_func(ti->ti_arg);
+	threadexit(0);
+}
+
+/*
+ * Start a thread running FUNC(ARG). Returns its thread id, which is
+ * also its pid.
+ */
+pid_t
+threadfork(void (*func)(void *), void *arg)
+{
+	struct threadinfo *ti;
+	char *stacktop;
+	pid_t tid;
+
+	ti = malloc(sizeof(struct threadinfo));
+	if (ti == NULL) {
+		return -1;
+	}
+	ti->ti_stack = malloc(THREAD_STACKSIZE);
+	if (ti->ti_stack == NULL) {
+		free(ti);
+		return -1;
+	}
+	ti->ti_func = func;
+	ti->ti_arg = arg;
+
+	/*
+	 * Leave room at the top for the argument slots the MIPS
+	 * calling convention lets threadstart spill into.
+	 */
+	stacktop = (char *)ti->ti_stack + THREAD_STACKSIZE - 16;
+
+	tid = __threadfork(threadstart, ti, stacktop);
+	if (tid < 0) {
+		free(ti->ti_stack);
+		free(ti);
+		return -1;
+	}
+
+	mutex_lock(&threads_lock);
+	ti->ti_tid = tid;
+	ti->ti_next = threads;
+	threads = ti;
+	mutex_unlock(&threads_lock);
+
+	return tid;
+}
+
+/*
+ * Wait for thread TID to exit and free its stack. Only the thread
+ * that created TID can join it. If STATUS is not NULL, the thread's
+ * exit code is stored there.
+ */
+int
+threadjoin(pid_t tid, int *status)
+{
+	struct threadinfo **tip, *ti;
+	int result;
+
+	if (waitpid(tid, &result, 0) < 0) {
+		return -1;
+	}
+	if (status != NULL) {
+		*status = WEXITSTATUS(result);
+	}
+
+	mutex_lock(&threads_lock);
+	for (tip = &threads; *tip != NULL; tip = &(*tip)->ti_next) {
+		if ((*tip)->ti_tid == tid) {
+			break;
+		}
+	}
+	ti = *tip;
+	if (ti != NULL) {
+		*tip = ti->ti_next;
+	}
+	mutex_unlock(&threads_lock);
+
+	if (ti != NULL) {
+		free(ti->ti_stack);
+		free(ti);
+	}
+	return 0;
+}
+
+/*
+ * End the calling thread. Other threads keep running; the process
+ * goes away when the last of them exits.
+ */
+void
+threadexit(int code)
+{
+	_exit(code);
+}
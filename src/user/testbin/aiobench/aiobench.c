@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * aiobench.c
+ *
+ * 	Compare writing and reading a file with pwrite and pread, one
+ *	chunk at a time, against keeping several chunks in flight with
+ *	aio_write and aio_read while computing the next one.
+ *
+ * Usage: aiobench [kbytes]
+ *
+ * Writes a scratch file of the given size (256K by default) in 16K
+ * chunks, generating each chunk with a bit of busywork first so
+ * there's computation to overlap with the disk. Then reads it back
+ * and checks it. Each is done both ways, and the time and throughput
+ * of each are printed. The file is removed afterwards.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define DEFAULT_KB	256
+#define TESTFILE	"aiobench.tmp"
+#define CHUNK		(16*1024)
+
+/* requests kept in flight by the async versions */
+#define DEPTH		8
+
+static char bufs[DEPTH][CHUNK];
+static int ids[DEPTH];
+
+/*
+ * Fill BUF with the contents of chunk N. Deliberately slow: it stands
+ * in for whatever a real program computes between i/o calls.
+ */
+static
+void
+fillchunk(char *buf, int n)
+{
+	unsigned x;
+	int i;
+
+	x = n * 2654435761U + 1;
+	for (i=0; i<CHUNK; i++) {
+		x = x * 1103515245 + 12345;
+		buf[i] = 'a' + (x >> 16) % 26;
+	}
+}
+
+/*
+ * Check that BUF holds chunk N.
+ */
+static
+void
+checkchunk(const char *buf, int n)
+{
+	static char expect[CHUNK];
+
+	fillchunk(expect, n);
+	if (memcmp(buf, expect, CHUNK) != 0) {
+		errx(1, "%s: data mismatch in chunk %d", TESTFILE, n);
+	}
+}
+
+/*
+ * Microseconds from START to now.
+ */
+static
+unsigned long
+since(time_t startsecs, unsigned long startnsecs)
+{
+	time_t endsecs;
+	unsigned long endnsecs;
+
+	__time(&endsecs, &endnsecs);
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	return (endsecs - startsecs) * 1000000
+		+ (endnsecs - startnsecs) / 1000;
+}
+
+static
+void
+syncwrite(int fd, int nchunks)
+{
+	int n;
+
+	for (n=0; n<nchunks; n++) {
+		fillchunk(bufs[0], n);
+		if (pwrite(fd, bufs[0], CHUNK, (off_t)n * CHUNK) != CHUNK) {
+			err(1, "%s: pwrite", TESTFILE);
+		}
+	}
+}
+
+static
+void
+syncread(int fd, int nchunks)
+{
+	int n;
+
+	for (n=0; n<nchunks; n++) {
+		if (pread(fd, bufs[0], CHUNK, (off_t)n * CHUNK) != CHUNK) {
+			err(1, "%s: pread", TESTFILE);
+		}
+		checkchunk(bufs[0], n);
+	}
+}
+
+/*
+ * Wait for the request in slot N % DEPTH and make sure it moved a
+ * whole chunk.
+ */
+static
+void
+finish(int n, const char *what)
+{
+	if (aio_wait(ids[n % DEPTH]) != CHUNK) {
+		err(1, "%s: %s of chunk %d", TESTFILE, what, n);
+	}
+}
+
+/*
+ * aio_write copies the data in before returning, but the slots are
+ * still recycled only after the request in them is done, so that
+ * no more than DEPTH are ever outstanding.
+ */
+static
+void
+asyncwrite(int fd, int nchunks)
+{
+	int n;
+
+	for (n=0; n<nchunks; n++) {
+		if (n >= DEPTH) {
+			finish(n - DEPTH, "aio_write");
+		}
+		fillchunk(bufs[n % DEPTH], n);
+		ids[n % DEPTH] = aio_write(fd, bufs[n % DEPTH], CHUNK,
+					   (off_t)n * CHUNK);
+		if (ids[n % DEPTH] < 0) {
+			err(1, "%s: aio_write", TESTFILE);
+		}
+	}
+	for (n = nchunks > DEPTH ? nchunks - DEPTH : 0; n<nchunks; n++) {
+		finish(n, "aio_write");
+	}
+}
+
+/*
+ * Start DEPTH reads, then check each chunk as it arrives and start
+ * the read DEPTH chunks further on in its place.
+ */
+static
+void
+asyncread(int fd, int nchunks)
+{
+	int n;
+
+	for (n=0; n<nchunks && n<DEPTH; n++) {
+		ids[n] = aio_read(fd, bufs[n], CHUNK, (off_t)n * CHUNK);
+		if (ids[n] < 0) {
+			err(1, "%s: aio_read", TESTFILE);
+		}
+	}
+	for (n=0; n<nchunks; n++) {
+		finish(n, "aio_read");
+		checkchunk(bufs[n % DEPTH], n);
+		if (n + DEPTH < nchunks) {
+			ids[n % DEPTH] = aio_read(fd, bufs[n % DEPTH], CHUNK,
+						  (off_t)(n + DEPTH) * CHUNK);
+			if (ids[n % DEPTH] < 0) {
+				err(1, "%s: aio_read", TESTFILE);
+			}
+		}
+	}
+}
+
+/*
+ * Run FUNC on the test file and report.
+ */
+static
+void
+runone(const char *what, void (*func)(int, int), int flags, int nchunks)
+{
+	time_t startsecs;
+	unsigned long startnsecs, usecs, msecs;
+	int fd;
+
+	fd = open(TESTFILE, flags);
+	if (fd < 0) {
+		err(1, "%s", TESTFILE);
+	}
+
+	__time(&startsecs, &startnsecs);
+	func(fd, nchunks);
+	usecs = since(startsecs, startnsecs);
+
+	close(fd);
+
+	msecs = (usecs + 999) / 1000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	printf("%-12s %8lu us  %6lu KB/s\n", what, usecs,
+	       (unsigned long)(nchunks * (CHUNK / 1024)) * 1000 / msecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int kb, nchunks;
+
+	kb = DEFAULT_KB;
+	if (argc == 2) {
+		kb = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: aiobench [kbytes]");
+	}
+	if (kb <= 0) {
+		errx(1, "aiobench: size must be positive");
+	}
+	nchunks = (kb * 1024 + CHUNK - 1) / CHUNK;
+
+	printf("Writing and reading %d KB in %d KB chunks\n",
+	       nchunks * (CHUNK / 1024), CHUNK / 1024);
+
+	runone("pwrite", syncwrite, O_WRONLY|O_CREAT|O_TRUNC, nchunks);
+	runone("pread", syncread, O_RDONLY, nchunks);
+	runone("aio_write", asyncwrite, O_WRONLY|O_CREAT|O_TRUNC, nchunks);
+	runone("aio_read", asyncread, O_RDONLY, nchunks);
+
+	remove(TESTFILE);
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * batchbench.c
+ *
+ * 	Compare making many one-byte writes as separate system calls,
+ *	the way putchar does, with making them in groups through batch.
+ *
+ * Usage: batchbench [count]
+ *
+ * Writes COUNT bytes (10000 by default) one at a time to null:, so
+ * that the time is all trap overhead, first with write and then with
+ * batch in groups of BATCHSIZE, and prints the time per call for each.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <batch.h>
+#include <err.h>
+
+#define DEFAULT_COUNT	10000
+#define NULLDEV		"null:"
+#define BATCHSIZE	64
+
+static struct sysbatch recs[BATCHSIZE];
+static const char byte = 'x';
+
+/*
+ * Microseconds from START to now.
+ */
+static
+unsigned long
+since(time_t startsecs, unsigned long startnsecs)
+{
+	time_t endsecs;
+	unsigned long endnsecs;
+
+	__time(&endsecs, &endnsecs);
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	return (endsecs - startsecs) * 1000000
+		+ (endnsecs - startnsecs) / 1000;
+}
+
+static
+void
+writeloop(int fd, int count)
+{
+	int i;
+
+	for (i=0; i<count; i++) {
+		if (write(fd, &byte, 1) != 1) {
+			err(1, "%s: write", NULLDEV);
+		}
+	}
+}
+
+static
+void
+batchloop(int fd, int count)
+{
+	int i, n, done;
+
+	for (i=0; i<BATCHSIZE; i++) {
+		recs[i].sb_callno = SYS_write;
+		recs[i].sb_args[0] = fd;
+		recs[i].sb_args[1] = (__u32)&byte;
+		recs[i].sb_args[2] = 1;
+	}
+
+	for (done=0; done<count; done+=n) {
+		n = count - done;
+		if (n > BATCHSIZE) {
+			n = BATCHSIZE;
+		}
+		if (batch(recs, n, BATCH_STOPONERR) != n) {
+			err(1, "batch");
+		}
+		for (i=0; i<n; i++) {
+			if (recs[i].sb_errno != 0 || recs[i].sb_retval != 1) {
+				errx(1, "%s: batched write %d failed: %s",
+				     NULLDEV, done + i,
+				     strerror(recs[i].sb_errno));
+			}
+		}
+	}
+}
+
+/*
+ * Run FUNC and report.
+ */
+static
+void
+runone(const char *what, void (*func)(int, int), int count)
+{
+	time_t startsecs;
+	unsigned long startnsecs, usecs;
+	int fd;
+
+	fd = open(NULLDEV, O_WRONLY);
+	if (fd < 0) {
+		err(1, "%s", NULLDEV);
+	}
+
+	__time(&startsecs, &startnsecs);
+	func(fd, count);
+	usecs = since(startsecs, startnsecs);
+
+	close(fd);
+
+	printf("%-8s %8lu us  %5lu ns/call\n", what, usecs,
+	       usecs / count * 1000 + usecs % count * 1000 / count);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count;
+
+	count = DEFAULT_COUNT;
+	if (argc == 2) {
+		count = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: batchbench [count]");
+	}
+	if (count <= 0) {
+		errx(1, "batchbench: count must be positive");
+	}
+
+	printf("Making %d one-byte writes, batches of %d\n",
+	       count, BATCHSIZE);
+
+	runone("write", writeloop, count);
+	runone("batch", batchloop, count);
+
+	return 0;
+}
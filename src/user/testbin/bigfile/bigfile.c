@@ -43,6 +43,7 @@
 #include <err.h>
 
 static char buffer[100];
+static char readback[100];
 
 int
 main(int argc, char *argv[])
@@ -50,7 +51,7 @@ main(int argc, char *argv[])
 	const char *filename;
 	int i, size;
 	int fileid;
-	int len;
+	int len, rlen;
 
 	if (argc != 3) {
 		errx(1, "Usage: bigfile <filename> <size>");
@@ -61,21 +62,39 @@ main(int argc, char *argv[])
 
 	printf("Creating a file of size %d\n", size);
 
-	fileid = open(filename, O_WRONLY|O_CREAT|O_TRUNC);
+	fileid = open(filename, O_RDWR|O_CREAT|O_TRUNC);
 	if (fileid < 0) {
 		err(1, "%s: create", filename);
 	}
 
+	/* we know where each chunk goes, so use pwrite and skip the seeks */
 	i=0;
 	while (i<size) {
 		snprintf(buffer, sizeof(buffer), "%-10d", i);
-		len = write(fileid, buffer, strlen(buffer));
+		len = pwrite(fileid, buffer, strlen(buffer), i);
 		if (len<0) {
-			err(1, "%s: write", filename);
+			err(1, "%s: pwrite", filename);
 		}
 		i += len;
 	}	
 
+	printf("Checking the file\n");
+
+	/* read it back the same way */
+	i=0;
+	while (i<size) {
+		snprintf(buffer, sizeof(buffer), "%-10d", i);
+		len = strlen(buffer);
+		rlen = pread(fileid, readback, len, i);
+		if (rlen<0) {
+			err(1, "%s: pread", filename);
+		}
+		if (rlen != len || memcmp(buffer, readback, len) != 0) {
+			errx(1, "%s: data mismatch at offset %d", filename, i);
+		}
+		i += len;
+	}
+
 	close(fileid);
 
 	return 0;
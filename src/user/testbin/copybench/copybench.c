@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * copybench.c
+ *
+ * 	Compare copying a file through a userlevel buffer, the way cp
+ *	used to, with copying it in the kernel with copy_file_range.
+ *
+ * Usage: copybench [kbytes]
+ *
+ * Makes a scratch file of the given size (256K by default), copies
+ * it both ways, checks the copies, and prints the time and throughput
+ * of each. The files are removed afterwards.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define DEFAULT_KB	256
+#define SRCFILE		"copybench.src"
+#define DSTFILE		"copybench.dst"
+
+/* the buffer cp and cat used to read into */
+#define OLDBUFSIZE	1024
+
+/* how much to ask for per copy_file_range call */
+#define COPY_MAX	(1024*1024)
+
+static char buf[OLDBUFSIZE];
+static char checkbuf[OLDBUFSIZE];
+
+/*
+ * Microseconds from START to now.
+ */
+static
+unsigned long
+since(time_t startsecs, unsigned long startnsecs)
+{
+	time_t endsecs;
+	unsigned long endnsecs;
+
+	__time(&endsecs, &endnsecs);
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	return (endsecs - startsecs) * 1000000
+		+ (endnsecs - startnsecs) / 1000;
+}
+
+/*
+ * Fill the source file with SIZE bytes of something recognizable.
+ */
+static
+void
+makesrc(int size)
+{
+	int fd, i, len;
+
+	fd = open(SRCFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", SRCFILE);
+	}
+	for (i=0; i<OLDBUFSIZE; i++) {
+		buf[i] = 'a' + i % 26;
+	}
+	for (i=0; i<size; i+=len) {
+		len = size - i;
+		if (len > OLDBUFSIZE) {
+			len = OLDBUFSIZE;
+		}
+		if (write(fd, buf, len) != len) {
+			err(1, "%s: write", SRCFILE);
+		}
+	}
+	close(fd);
+}
+
+/*
+ * The old cp: read into a buffer, write it out.
+ */
+static
+void
+copyloop(int fromfd, int tofd)
+{
+	int len, wr, wrtot;
+
+	while ((len = read(fromfd, buf, sizeof(buf))) > 0) {
+		wrtot = 0;
+		while (wrtot < len) {
+			wr = write(tofd, buf+wrtot, len-wrtot);
+			if (wr < 0) {
+				err(1, "%s: write", DSTFILE);
+			}
+			wrtot += wr;
+		}
+	}
+	if (len < 0) {
+		err(1, "%s: read", SRCFILE);
+	}
+}
+
+/*
+ * The new cp.
+ */
+static
+void
+copykernel(int fromfd, int tofd)
+{
+	int len;
+
+	while ((len = copy_file_range(fromfd, NULL, tofd, NULL,
+				      COPY_MAX)) > 0) {
+		/* nothing */
+	}
+	if (len < 0) {
+		err(1, "copy_file_range");
+	}
+}
+
+/*
+ * Make sure the copy came out the same as the original.
+ */
+static
+void
+check(int size)
+{
+	int fd1, fd2, len1, len2, total;
+
+	fd1 = open(SRCFILE, O_RDONLY);
+	if (fd1 < 0) {
+		err(1, "%s", SRCFILE);
+	}
+	fd2 = open(DSTFILE, O_RDONLY);
+	if (fd2 < 0) {
+		err(1, "%s", DSTFILE);
+	}
+	total = 0;
+	while ((len1 = read(fd1, buf, sizeof(buf))) > 0) {
+		len2 = read(fd2, checkbuf, len1);
+		if (len2 != len1 || memcmp(buf, checkbuf, len1) != 0) {
+			errx(1, "%s: data mismatch at offset %d",
+			     DSTFILE, total);
+		}
+		total += len1;
+	}
+	if (total != size || read(fd2, checkbuf, 1) != 0) {
+		errx(1, "%s: wrong size", DSTFILE);
+	}
+	close(fd2);
+	close(fd1);
+}
+
+/*
+ * Copy the file with FUNC, check it, and report.
+ */
+static
+void
+runone(const char *what, void (*func)(int, int), int size)
+{
+	time_t startsecs;
+	unsigned long startnsecs, usecs, msecs;
+	int fromfd, tofd;
+
+	fromfd = open(SRCFILE, O_RDONLY);
+	if (fromfd < 0) {
+		err(1, "%s", SRCFILE);
+	}
+	tofd = open(DSTFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	if (tofd < 0) {
+		err(1, "%s", DSTFILE);
+	}
+
+	__time(&startsecs, &startnsecs);
+	func(fromfd, tofd);
+	usecs = since(startsecs, startnsecs);
+
+	close(tofd);
+	close(fromfd);
+	check(size);
+
+	msecs = (usecs + 999) / 1000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+	printf("%-16s %8lu us  %6lu KB/s\n", what, usecs,
+	       (unsigned long)(size / 1024) * 1000 / msecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int kb, size;
+
+	kb = DEFAULT_KB;
+	if (argc == 2) {
+		kb = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: copybench [kbytes]");
+	}
+	if (kb <= 0) {
+		errx(1, "copybench: size must be positive");
+	}
+	size = kb * 1024;
+
+	printf("Copying %d KB\n", kb);
+	makesrc(size);
+
+	runone("read/write", copyloop, size);
+	runone("copy_file_range", copykernel, size);
+
+	remove(DSTFILE);
+	remove(SRCFILE);
+	return 0;
+}
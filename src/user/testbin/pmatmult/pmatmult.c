@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* pmatmult.c
+ *    Parallel version of matmult: the same storage-inefficient
+ *    matrix multiplication, with the rows split among several
+ *    threads sharing one address space.
+ *
+ *    Usage: pmatmult [nthreads]
+ *
+ *    With more than one CPU this should finish in a fraction of
+ *    matmult's time, and get the same answer.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define Dim 	72	/* sum total of the arrays doesn't fit in 
+			 * physical memory 
+			 */
+
+#define RIGHT  8772192		/* correct answer */
+
+#define DEFTHREADS	4
+#define MAXTHREADS	Dim
+
+int A[Dim][Dim];
+int B[Dim][Dim];
+int C[Dim][Dim];
+int T[Dim][Dim][Dim];
+
+static int nthreads;
+
+/*
+ * Compute rows [first, last) of C. Rows are independent, so the
+ * threads never touch the same part of T or C.
+ */
+static
+void
+multiply(void *arg)
+{
+    int n = (int)(unsigned long)arg;
+    int first, last, i, j, k;
+
+    first = n * Dim / nthreads;
+    last = (n + 1) * Dim / nthreads;
+
+    for (i = first; i < last; i++)
+	for (j = 0; j < Dim; j++)
+            for (k = 0; k < Dim; k++)
+		T[i][j][k] = A[i][k] * B[k][j];
+
+    for (i = first; i < last; i++)
+	for (j = 0; j < Dim; j++)
+            for (k = 0; k < Dim; k++)
+		C[i][j] += T[i][j][k];
+}
+
+int
+main(int argc, char *argv[])
+{
+    pid_t tids[MAXTHREADS];
+    int i, j, r, status, failed;
+
+    nthreads = DEFTHREADS;
+    if (argc > 1) {
+	nthreads = atoi(argv[1]);
+    }
+    if (nthreads < 1 || nthreads > MAXTHREADS) {
+	errx(1, "Usage: pmatmult [nthreads], 1 <= nthreads <= %d",
+	     MAXTHREADS);
+    }
+
+    for (i = 0; i < Dim; i++)		/* first initialize the matrices */
+	for (j = 0; j < Dim; j++) {
+	     A[i][j] = i;
+	     B[i][j] = j;
+	     C[i][j] = 0;
+	}
+
+    /* the main thread does the last share itself */
+    for (i = 0; i < nthreads - 1; i++) {
+	tids[i] = threadfork(multiply, (void *)(unsigned long)i);
+	if (tids[i] < 0) {
+	    err(1, "threadfork");
+	}
+    }
+    multiply((void *)(unsigned long)(nthreads - 1));
+
+    failed = 0;
+    for (i = 0; i < nthreads - 1; i++) {
+	if (threadjoin(tids[i], &status) < 0) {
+	    warn("threadjoin");
+	    failed = 1;
+	}
+	else if (status != 0) {
+	    warnx("thread %d exited with %d", i, status);
+	    failed = 1;
+	}
+    }
+    if (failed) {
+	printf("FAILED\n");
+	return 1;
+    }
+
+    r = 0;
+    for (i = 0; i < Dim; i++)
+	    r += C[i][i];
+
+    printf("pmatmult finished (%d threads).\n", nthreads);
+    printf("answer is: %d (should be %d)\n", r, RIGHT);
+    if (r != RIGHT) {
+	    printf("FAILED\n");
+	    return 1;
+    }
+    printf("Passed.\n");
+    return 0;
+}
@@ -47,6 +47,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 
 #ifndef RANDOM_MAX
 /* Note: this is correct for OS/161 but not for some Unix C libraries */
@@ -60,6 +61,9 @@
 
 #define WORKNUM      (128*1024)
 
+/* somewhere out of the way to keep stdout while spawning */
+#define SAVED_STDOUT (OPEN_MAX-1)
+
 
 static int workspace[WORKNUM];
 
@@ -350,6 +354,40 @@ dowrite(const char *path, int fd, const void *buf, size_t len)
 	}
 }
 
+static
+void
+doexactpread(const char *path, int fd, void *buf, size_t len, off_t offset)
+{
+	int result;
+
+	result = pread(fd, buf, len, offset);
+	if (result < 0) {
+		complain("%s: pread", path);
+		exit(1);
+	}
+	if ((size_t) result != len) {
+		complainx("%s: pread: short count", path);
+		exit(1);
+	}
+}
+
+static
+void
+dopwrite(const char *path, int fd, const void *buf, size_t len, off_t offset)
+{
+	int result;
+
+	result = pwrite(fd, buf, len, offset);
+	if (result < 0) {
+		complain("%s: pwrite", path);
+		exit(1);
+	}
+	if ((size_t) result != len) {
+		complainx("%s: pwrite: short count", path);
+		exit(1);
+	}
+}
+
 static
 void
 dolseek(const char *name, int fd, off_t offset, int whence)
@@ -399,17 +437,32 @@ dofork(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Wait for whichever of the procs in PIDS exits next, and clear its
+ * slot. Returns -1 if it failed.
+ */
 static
 int
-dowait(int guy, pid_t pid)
+dowaitany(pid_t *pids)
 {
-	int status, result;
+	int guy, status;
+	pid_t result;
 
-	result = waitpid(pid, &status, 0);
+	result = waitpid(WAIT_ANY, &status, 0);
 	if (result < 0) {
 		complain("waitpid");
 		return -1;
 	}
+	for (guy=0; guy<numprocs; guy++) {
+		if (pids[guy] == result) {
+			break;
+		}
+	}
+	if (guy == numprocs) {
+		complainx("waitpid: unexpected pid %d", result);
+		return -1;
+	}
+	pids[guy] = -1;
 	if (WIFSIGNALED(status)) {
 		complainx("proc %d: signal %d", guy, WTERMSIG(status));
 		return -1;
@@ -423,11 +476,33 @@ dowait(int guy, pid_t pid)
 	return 0;
 }
 
+/*
+ * Collect the NRUNNING procs in PIDS, in whatever order they finish,
+ * and give up if any of them (or starting any of them) failed.
+ */
+static
+void
+dowaitall(const char *phasename, pid_t *pids, int nrunning, int bad)
+{
+	int i;
+
+	for (i=0; i<nrunning; i++) {
+		if (dowaitany(pids)) {
+			bad = 1;
+		}
+	}
+
+	if (bad) {
+		complainx("%s failed.", phasename);
+		exit(1);
+	}
+}
+
 static
 void
 doforkall(const char *phasename, void (*func)(void))
 {
-	int i, bad = 0;
+	int i, bad = 0, nrunning = 0;
 	pid_t pids[numprocs];
 
 	for (i=0; i<numprocs; i++) {
@@ -441,32 +516,27 @@ doforkall(const char *phasename, void (*func)(void))
 			func();
 			exit(0);
 		}
-	}
-
-	for (i=0; i<numprocs; i++) {
-		if (pids[i] > 0 && dowait(i, pids[i])) {
-			bad = 1;
+		else {
+			nrunning++;
 		}
 	}
 
-	if (bad) {
-		complainx("%s failed.", phasename);
-		exit(1);
-	}
+	dowaitall(phasename, pids, nrunning, bad);
 }
 
+/*
+ * Where my keys start in a file of all the keys. We read and write
+ * there with pread and pwrite, so there's no need to seek.
+ */
 static
-void
-seekmyplace(const char *name, int fd)
+off_t
+myplace(void)
 {
 	int keys_per, myfirst;
-	off_t offset;
 
 	keys_per = numkeys / numprocs;
 	myfirst = me*keys_per;
-	offset = myfirst * sizeof(int);
-
-	dolseek(name, fd, offset, SEEK_SET);
+	return myfirst * sizeof(int);
 }
 
 static
@@ -515,11 +585,12 @@ void
 genkeys_sub(void)
 {
 	int fd, i, mykeys, keys_done, keys_to_do, value;
+	off_t pos;
 
 	fd = doopen(PATH_KEYS, O_WRONLY, 0);
 
 	mykeys = getmykeys();
-	seekmyplace(PATH_KEYS, fd);
+	pos = myplace();
 
 	srandom(seeds[me]);
 	keys_done = 0;
@@ -544,7 +615,9 @@ genkeys_sub(void)
 			workspace[i] = value;
 		}
 
-		dowrite(PATH_KEYS, fd, workspace, keys_to_do*sizeof(int));
+		dopwrite(PATH_KEYS, fd, workspace, keys_to_do*sizeof(int),
+			 pos);
+		pos += keys_to_do*sizeof(int);
 		keys_done += keys_to_do;
 	}
 
@@ -611,11 +684,12 @@ bin(void)
 	const char *name;
 	int i, mykeys, keys_done, keys_to_do;
 	int key, pivot, binnum;
+	off_t pos;
 
 	infd = doopen(PATH_KEYS, O_RDONLY, 0);
 
 	mykeys = getmykeys();
-	seekmyplace(PATH_KEYS, infd);
+	pos = myplace();
 
 	for (i=0; i<numprocs; i++) {
 		name = binname(me, i);
@@ -631,8 +705,9 @@ bin(void)
 			keys_to_do = WORKNUM;
 		}
 
-		doexactread(PATH_KEYS, infd, workspace,
-			    keys_to_do * sizeof(int));
+		doexactpread(PATH_KEYS, infd, workspace,
+			     keys_to_do * sizeof(int), pos);
+		pos += keys_to_do * sizeof(int);
 
 		for (i=0; i<keys_to_do; i++) {
 			key = workspace[i];
@@ -678,12 +753,11 @@ sortbins(void)
 		}
 
 		fd = doopen(name, O_RDWR, 0);
-		doexactread(name, fd, workspace, binsize);
+		doexactpread(name, fd, workspace, binsize, 0);
 
 		sortints(workspace, binsize/sizeof(int));
 
-		dolseek(name, fd, 0, SEEK_SET);
-		dowrite(name, fd, workspace, binsize);
+		dopwrite(name, fd, workspace, binsize, 0);
 		doclose(name, fd);
 	}
 }
@@ -770,16 +844,22 @@ mergebins(void)
 	}
 }
 
+/*
+ * Start a cat to copy merged bin GUY into its place in the output
+ * file. We don't need a copy of ourselves to do that, so use spawn,
+ * with stdout pointed at the right spot beforehand.
+ */
 static
-void
-assemble(void)
+pid_t
+spawnassemble(int guy)
 {
 	off_t mypos;
 	int i, fd;
+	pid_t pid;
 	const char *args[3];
 
 	mypos = 0;
-	for (i=0; i<me; i++) {
+	for (i=0; i<guy; i++) {
 		mypos += getsize(mergedname(i));
 	}
 
@@ -794,11 +874,46 @@ assemble(void)
 	doclose(PATH_SORTED, fd);
 
 	args[0] = "cat";
-	args[1] = mergedname(me);
+	args[1] = mergedname(guy);
 	args[2] = NULL;
-	execv("/bin/cat", (char **) args);
-	complain("/bin/cat: exec");
-	exit(1);
+	pid = spawn("/bin/cat", (char **) args);
+	if (pid < 0) {
+		complain("/bin/cat: spawn");
+		/* but don't exit */
+	}
+	return pid;
+}
+
+static
+void
+assembleall(void)
+{
+	int i, bad = 0, nrunning = 0;
+	pid_t pids[numprocs];
+
+	/* we only print to stderr, but put stdout back afterwards anyway */
+	if (dup2(STDOUT_FILENO, SAVED_STDOUT) < 0) {
+		complain("dup2");
+		exit(1);
+	}
+
+	for (i=0; i<numprocs; i++) {
+		pids[i] = spawnassemble(i);
+		if (pids[i] < 0) {
+			bad = 1;
+		}
+		else {
+			nrunning++;
+		}
+	}
+
+	if (dup2(SAVED_STDOUT, STDOUT_FILENO) < 0) {
+		complain("dup2");
+		exit(1);
+	}
+	close(SAVED_STDOUT);
+
+	dowaitall("Final assembly", pids, nrunning, bad);
 }
 
 static
@@ -870,7 +985,7 @@ sort(void)
 
 	/* Step 4: assemble output file */
 	docreate(PATH_SORTED);
-	doforkall("Final assembly", assemble);
+	assembleall();
 	if (getsize(PATH_SORTED) != correctsize) {
 		complainx("%s: file is wrong size", PATH_SORTED);
 		exit(1);
@@ -930,12 +1045,13 @@ dovalidate(void)
 	const char *name;
 	int fd, i, mykeys, keys_done, keys_to_do;
 	int key, smallest, largest;
+	off_t pos;
 
 	name = PATH_SORTED;
 	fd = doopen(name, O_RDONLY, 0);
 
 	mykeys = getmykeys();
-	seekmyplace(name, fd);
+	pos = myplace();
 
 	smallest = RANDOM_MAX;
 	largest = 0;
@@ -947,7 +1063,9 @@ dovalidate(void)
 			keys_to_do = WORKNUM;
 		}
 
-		doexactread(name, fd, workspace, keys_to_do * sizeof(int));
+		doexactpread(name, fd, workspace, keys_to_do * sizeof(int),
+			     pos);
+		pos += keys_to_do * sizeof(int);
 
 		for (i=0; i<keys_to_do; i++) {
 			key = workspace[i];
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * schedlat.c
+ *
+ * 	Measure how long it takes to run a trivial shell command, first
+ *	on an idle system and then with a number of cpu hogs running.
+ *
+ * Usage: schedlat [nhogs]
+ *
+ * The command run is "/bin/sh -c /bin/true", so each sample covers a
+ * fork, two execs, and two waits - roughly what a user sees when
+ * typing a command at the shell. With a scheduler that favors
+ * interactive threads the latency with hogs running should stay close
+ * to the idle latency; with plain round-robin it grows with the
+ * number of hogs.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define DEFAULT_HOGS	4
+#define MAXHOGS		16
+#define NSAMPLES	10
+
+/* How long the hogs run, in seconds; should outlast the samples. */
+#define HOGSECS		60
+
+static char *shargv[4] = {
+	(char *)"sh", (char *)"-c", (char *)"/bin/true", NULL
+};
+
+static pid_t hogpids[MAXHOGS];
+
+/*
+ * Burn cpu until HOGSECS have passed. Checking the time is itself a
+ * system call, so only do it every so often.
+ */
+static
+void
+hog(void)
+{
+	time_t start, now;
+	unsigned long nsecs;
+	volatile int i;
+
+	__time(&start, &nsecs);
+	do {
+		for (i=0; i<100000; i++) {
+			;
+		}
+		__time(&now, &nsecs);
+	} while (now - start < HOGSECS);
+	_exit(0);
+}
+
+/*
+ * Run the shell command once and return how long it took, in
+ * microseconds.
+ */
+static
+unsigned long
+runone(void)
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	pid_t pid;
+	int status;
+
+	__time(&startsecs, &startnsecs);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		execv("/bin/sh", shargv);
+		warn("/bin/sh");
+		_exit(1);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		warnx("sh -c /bin/true: exit %d", WEXITSTATUS(status));
+	}
+
+	__time(&endsecs, &endnsecs);
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	return (endsecs - startsecs) * 1000000
+		+ (endnsecs - startnsecs) / 1000;
+}
+
+static
+void
+measure(const char *what)
+{
+	unsigned long t, min, max, total;
+	int i;
+
+	min = (unsigned long)-1;
+	max = total = 0;
+	for (i=0; i<NSAMPLES; i++) {
+		t = runone();
+		if (t < min) {
+			min = t;
+		}
+		if (t > max) {
+			max = t;
+		}
+		total += t;
+	}
+	printf("schedlat: %s: min %lu us, avg %lu us, max %lu us\n",
+	       what, min, total / NSAMPLES, max);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char what[32];
+	int nhogs, i, status;
+
+	nhogs = DEFAULT_HOGS;
+	if (argc == 2) {
+		nhogs = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: schedlat [nhogs]");
+	}
+	if (nhogs < 0 || nhogs > MAXHOGS) {
+		errx(1, "nhogs must be between 0 and %d", MAXHOGS);
+	}
+
+	measure("idle");
+
+	for (i=0; i<nhogs; i++) {
+		hogpids[i] = fork();
+		if (hogpids[i] < 0) {
+			err(1, "fork");
+		}
+		if (hogpids[i] == 0) {
+			hog();
+		}
+	}
+
+	snprintf(what, sizeof(what), "%d hogs", nhogs);
+	measure(what);
+
+	printf("schedlat: waiting for hogs to finish...\n");
+	for (i=0; i<nhogs; i++) {
+		if (waitpid(hogpids[i], &status, 0) < 0) {
+			warn("waitpid for hog %d", hogpids[i]);
+		}
+	}
+
+	return 0;
+}
@@ -32,10 +32,13 @@
  *
  * 	Outputs a file beginning at a specific location.
  *	Usage: tail <file> <location>
+ *	A negative location counts back from the end of the file.
  *
  * This may be useful for testing during the file system assignment.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <err.h>
@@ -51,8 +54,20 @@ static
 void
 tail(int file, off_t where, const char *filename)
 {
+	struct stat st;
 	int len;
 
+	if (where < 0) {
+		/* one fstat gets the size without moving the offset */
+		if (fstat(file, &st)<0) {
+			err(1, "%s: fstat", filename);
+		}
+		where += st.st_size;
+		if (where < 0) {
+			where = 0;
+		}
+	}
+
 	if (lseek(file, where, SEEK_SET)<0) {
 		err(1, "%s", filename);
 	}
@@ -35,14 +35,11 @@
  * This won't do much of anything unless you implement user-level
  * threads.
  *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
+ * It uses the libc thread API: (1) you create a thread by calling
+ * "threadfork()" with the function for the new thread to begin at and
+ * an argument for it, (2) if the parent thread exits any child
+ * threads keep running, and (3) child threads exit if they return
+ * from the function they started in.
  *
  * This is also a rather basic test and you'll probably want to write
  * some more of your own.
@@ -61,8 +58,8 @@
 volatile int count = 0;
 
 /* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+void ThreadRunner(void *);
+void BladeRunner(void *);
 
 int
 main(int argc, char *argv[])
@@ -74,9 +71,9 @@ main(int argc, char *argv[])
 
     for (i=0; i<NTHREADS; i++) {
 	if (i)
-	    threadfork(ThreadRunner);
+	    threadfork(ThreadRunner, NULL);
         else
-	    threadfork(BladeRunner);
+	    threadfork(BladeRunner, NULL);
     }
 
     printf("Parent has left.\n");
@@ -89,8 +86,10 @@ main(int argc, char *argv[])
 */
 
 void
-BladeRunner()
+BladeRunner(void *junk)
 {
+    (void)junk;
+
     while (count < MAX) {
 	if (count % 500 == 0)
 	    printf("Blade ");
@@ -99,8 +98,10 @@ BladeRunner()
 }
 
 void
-ThreadRunner()
+ThreadRunner(void *junk)
 {
+    (void)junk;
+
     while (count < MAX) {
 	if (count % 513 == 0)
 	    printf(" Runner\n");